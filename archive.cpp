@@ -0,0 +1,305 @@
+#include "archive.h"
+#include "tilebuilder.h"
+#include "compress.h"
+#include "ulib.h"
+
+#define SQLITEPP_LOGE LOG
+#define SQLITEPP_LOGW LOG
+#include "sqlitepp.h"
+
+// after geodesk headers, since fcntl.h #defines break them
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static constexpr size_t HEADER_SIZE = 127;
+static constexpr size_t ROOT_MAX = 16384;  // header and root directory must fit in first 16 KB
+static constexpr size_t MAX_DEDUP_BYTES = 1024;  // identical tiles up to this size are stored once
+enum { COMPRESS_NONE = 1, COMPRESS_GZIP = 2 };
+enum { TILETYPE_MVT = 1 };
+
+// PMTiles v3 header fields (little endian)
+static uint64_t getU64(const char* p) { uint64_t v = 0;  for(int ii = 7; ii >= 0; --ii) { v = v << 8 | uint8_t(p[ii]); }  return v; }
+static void putU64(char* p, uint64_t v) { for(int ii = 0; ii < 8; ++ii) { p[ii] = char(v >> 8*ii); } }
+static void putI32(char* p, int32_t v) { for(int ii = 0; ii < 4; ++ii) { p[ii] = char(uint32_t(v) >> 8*ii); } }
+
+static void putVarint(std::string& out, uint64_t v)
+{
+  for(; v >= 0x80; v >>= 7) { out.push_back(char(v | 0x80)); }
+  out.push_back(char(v));
+}
+
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v)
+{
+  v = 0;
+  for(int shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t b = *p++;
+    v |= uint64_t(b & 0x7F) << shift;
+    if(!(b & 0x80)) { return true; }
+  }
+  return false;
+}
+
+uint64_t TileArchive::tileId(TileID id)
+{
+  uint64_t d = ((uint64_t(1) << 2*id.z) - 1)/3;  // tiles at lower zooms
+  uint32_t x = id.x, y = id.y;
+  for(uint32_t s = (1u << id.z) >> 1; s > 0; s >>= 1) {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    d += uint64_t(s) * s * ((3 * rx) ^ ry);
+    if(ry == 0) {
+      if(rx == 1) { x = s - 1 - x;  y = s - 1 - y; }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+TileArchive::~TileArchive()
+{
+  if(m_data) { munmap((void*)m_data, m_size); }
+}
+
+bool TileArchive::open(const char* path)
+{
+  int fd = ::open(path, O_RDONLY);
+  if(fd < 0) { return false; }
+  struct stat st;
+  void* p = fstat(fd, &st) == 0 && size_t(st.st_size) >= HEADER_SIZE ?
+      mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  ::close(fd);  // mapping stays valid
+  if(p == MAP_FAILED) {
+    LOG("Error mapping tile archive %s", path);
+    return false;
+  }
+  m_data = (const char*)p;
+  m_size = st.st_size;
+
+  const char* h = m_data;
+  uint64_t rootOffset = getU64(h + 8), rootLength = getU64(h + 16);
+  uint64_t leafOffset = getU64(h + 40), leafLength = getU64(h + 48);
+  m_tileDataOffset = getU64(h + 56);
+  m_tileDataLength = getU64(h + 64);
+  int compression = h[97], tileCompression = h[98], tileType = h[99];
+  auto inFile = [&](uint64_t offset, uint64_t length){ return offset <= m_size && length <= m_size - offset; };
+  if(memcmp(h, "PMTiles", 7) != 0 || h[7] != 3 || !inFile(rootOffset, rootLength)
+      || !inFile(leafOffset, leafLength) || !inFile(m_tileDataOffset, m_tileDataLength)) {
+    LOG("Invalid tile archive %s (expected PMTiles v3)", path);
+    return false;
+  }
+  // tiles are served as stored, so must be gzip MVT like tiles in mbtiles
+  if(tileCompression != COMPRESS_GZIP || tileType != TILETYPE_MVT) {
+    LOG("Tile archive %s must contain gzip MVT tiles", path);
+    return false;
+  }
+  if(!readDirectory(std::string_view(m_data + rootOffset, rootLength), compression, leafOffset, 0)) {
+    LOG("Invalid directory in tile archive %s", path);
+    return false;
+  }
+  std::sort(m_entries.begin(), m_entries.end(), [](const Entry& a, const Entry& b){ return a.tileId < b.tileId; });
+  m_numTiles = 0;
+  for(const Entry& e : m_entries) { m_numTiles += e.runLength; }
+  LOG("Opened tile archive %s: %lu tiles (%lu entries), %.1f MB", path,
+      (unsigned long)m_numTiles, (unsigned long)m_entries.size(), m_size/1048576.0);
+  return true;
+}
+
+// decode directory, adding tile entries to m_entries and reading leaf directories (at most 3 levels)
+bool TileArchive::readDirectory(std::string_view dir, int compression, uint64_t leafOffset, int depth)
+{
+  std::string buf;
+  if(compression == COMPRESS_GZIP) {
+    if(!TileCompressor::gzip()->decompress(dir, buf)) { return false; }
+    dir = buf;
+  }
+  else if(compression != COMPRESS_NONE) { return false; }
+
+  const uint8_t* p = (const uint8_t*)dir.data();
+  const uint8_t* end = p + dir.size();
+  uint64_t n = 0, v = 0;
+  if(!getVarint(p, end, n) || n > dir.size()) { return false; }
+  std::vector<Entry> entries(n);
+  uint64_t id = 0;
+  for(Entry& e : entries) {
+    if(!getVarint(p, end, v)) { return false; }
+    e.tileId = (id += v);
+  }
+  for(Entry& e : entries) {
+    if(!getVarint(p, end, v)) { return false; }
+    e.runLength = uint32_t(v);
+  }
+  for(Entry& e : entries) {
+    if(!getVarint(p, end, v)) { return false; }
+    e.length = uint32_t(v);
+  }
+  for(size_t ii = 0; ii < entries.size(); ++ii) {
+    if(!getVarint(p, end, v) || (v == 0 && ii == 0)) { return false; }
+    // 0 means immediately after previous entry
+    entries[ii].offset = v == 0 ? entries[ii-1].offset + entries[ii-1].length : v - 1;
+  }
+
+  for(const Entry& e : entries) {
+    if(e.runLength > 0) {
+      if(e.offset > m_tileDataLength || e.length > m_tileDataLength - e.offset) { return false; }
+      m_entries.push_back(e);
+    }
+    else {
+      uint64_t start = leafOffset + e.offset;
+      if(depth >= 3 || start > m_size || e.length > m_size - start) { return false; }
+      if(!readDirectory(std::string_view(m_data + start, e.length), compression, leafOffset, depth + 1)) { return false; }
+    }
+  }
+  return true;
+}
+
+bool TileArchive::find(TileID id, std::string_view& data) const
+{
+  uint64_t tid = tileId(id);
+  auto it = std::upper_bound(m_entries.begin(), m_entries.end(), tid,
+      [](uint64_t t, const Entry& e){ return t < e.tileId; });
+  if(it == m_entries.begin()) { return false; }
+  --it;
+  if(tid >= it->tileId + it->runLength) { return false; }
+  data = std::string_view(m_data + m_tileDataOffset + it->offset, it->length);
+  return true;
+}
+
+// export
+
+static std::string serializeDirectory(const TileArchive::Entry* entries, size_t n)
+{
+  std::string dir, gz;
+  putVarint(dir, n);
+  uint64_t lastId = 0;
+  for(size_t ii = 0; ii < n; ++ii) { putVarint(dir, entries[ii].tileId - lastId);  lastId = entries[ii].tileId; }
+  for(size_t ii = 0; ii < n; ++ii) { putVarint(dir, entries[ii].runLength); }
+  for(size_t ii = 0; ii < n; ++ii) { putVarint(dir, entries[ii].length); }
+  for(size_t ii = 0; ii < n; ++ii) {
+    bool contiguous = ii > 0 && entries[ii].offset == entries[ii-1].offset + entries[ii-1].length;
+    putVarint(dir, contiguous ? 0 : entries[ii].offset + 1);
+  }
+  TileCompressor::gzip()->compress(dir, gz, 9);
+  return gz;
+}
+
+static double tileLng(int x, int z) { return x*360.0/(1 << z) - 180; }
+static double tileLat(int y, int z) { return std::atan(std::sinh(M_PI*(1 - 2.0*y/(1 << z))))*180/M_PI; }
+
+int exportArchive(const char* dbPath, const char* archivePath)
+{
+  SQLiteDB db;
+  if(db.open(dbPath, SQLITE_OPEN_READONLY) != SQLITE_OK) {
+    LOG("Error opening %s", dbPath);
+    return -1;
+  }
+  auto t0 = std::chrono::steady_clock::now();
+
+  // tiles (w/o data) in tile id order; empty tiles are left out, so server falls back to mbtiles for them
+  struct TileRow { uint64_t tileId; int64_t rowid; };
+  std::vector<TileRow> rows;
+  int minZ = INT_MAX, maxZ = -1;
+  int minX = INT_MAX, maxX = -1, minY = INT_MAX, maxY = -1;  // at maxZ
+  db.stmt("SELECT zoom_level, tile_column, tile_row, rowid FROM tiles WHERE length(tile_data) > 0;").exec(
+      [&](int z, int x, int row, int64_t rowid){
+    TileID id(x, (1 << z) - 1 - row, z);
+    rows.push_back({TileArchive::tileId(id), rowid});
+    minZ = std::min(minZ, z);
+    if(z > maxZ) { maxZ = z;  minX = INT_MAX;  maxX = -1;  minY = INT_MAX;  maxY = -1; }
+    if(z == maxZ) {
+      minX = std::min(minX, id.x);  maxX = std::max(maxX, id.x);
+      minY = std::min(minY, id.y);  maxY = std::max(maxY, id.y);
+    }
+  });
+  if(rows.empty()) {
+    LOG("No tiles in %s", dbPath);
+    return -1;
+  }
+  std::sort(rows.begin(), rows.end(), [](const TileRow& a, const TileRow& b){ return a.tileId < b.tileId; });
+
+  FILE* f = fopen(archivePath, "wb");
+  if(!f) {
+    LOG("Error opening %s", archivePath);
+    return -1;
+  }
+  // tile data follows space reserved for header and root directory, which are written last
+  bool ok = fseek(f, ROOT_MAX, SEEK_SET) == 0;
+  SQLiteStmt getTile = db.stmt("SELECT tile_data FROM tiles WHERE rowid = ?;");
+  std::vector<TileArchive::Entry> entries;
+  std::unordered_map<std::string, uint64_t> smallTiles;
+  std::string data;
+  uint64_t tileBytes = 0, ncontents = 0;
+  for(size_t ii = 0; ok && ii < rows.size(); ++ii) {
+    getTile.bind(rows[ii].rowid).exec([&](sqlite3_stmt* stmt){
+      const char* blob = (const char*) sqlite3_column_blob(stmt, 0);
+      data.assign(blob ? blob : "", sqlite3_column_bytes(stmt, 0));
+    });
+    uint64_t offset = tileBytes;
+    bool dup = false;
+    if(data.size() <= MAX_DEDUP_BYTES) {
+      auto ins = smallTiles.emplace(data, tileBytes);
+      offset = ins.first->second;
+      dup = !ins.second;
+    }
+    if(!dup) {
+      ok = fwrite(data.data(), data.size(), 1, f) == 1;
+      tileBytes += data.size();
+      ++ncontents;
+    }
+    // consecutive tiles w/ same data share an entry
+    TileArchive::Entry* last = entries.empty() ? nullptr : &entries.back();
+    if(last && last->tileId + last->runLength == rows[ii].tileId && last->offset == offset && last->length == data.size())
+      ++last->runLength;
+    else
+      entries.push_back({rows[ii].tileId, offset, uint32_t(data.size()), 1});
+    if((ii + 1) % (1 << 20) == 0) { LOG("Exported %lu/%lu tiles", (unsigned long)(ii + 1), (unsigned long)rows.size()); }
+  }
+
+  // split into leaf directories if root directory doesn't fit in first 16 KB
+  std::string root = serializeDirectory(entries.data(), entries.size()), leaves;
+  for(size_t leafSize = 4096; root.size() > ROOT_MAX - HEADER_SIZE; leafSize *= 2) {
+    std::vector<TileArchive::Entry> rootEntries;
+    leaves.clear();
+    for(size_t ii = 0; ii < entries.size(); ii += leafSize) {
+      std::string leaf = serializeDirectory(&entries[ii], std::min(leafSize, entries.size() - ii));
+      rootEntries.push_back({entries[ii].tileId, leaves.size(), uint32_t(leaf.size()), 0});
+      leaves.append(leaf);
+    }
+    root = serializeDirectory(rootEntries.data(), rootEntries.size());
+  }
+  std::string metadata;
+  TileCompressor::gzip()->compress(fstring(R"({"format": "pbf", "minzoom": %d, "maxzoom": %d})", minZ, maxZ), metadata, 9);
+  ok = ok && fwrite(leaves.data(), leaves.size(), 1, f) == 1 && fwrite(metadata.data(), metadata.size(), 1, f) == 1;
+
+  char h[HEADER_SIZE] = {};
+  memcpy(h, "PMTiles", 7);
+  h[7] = 3;
+  uint64_t leafOffset = ROOT_MAX + tileBytes, metaOffset = leafOffset + leaves.size();
+  putU64(h + 8, HEADER_SIZE);  putU64(h + 16, root.size());
+  putU64(h + 24, metaOffset);  putU64(h + 32, metadata.size());
+  putU64(h + 40, leafOffset);  putU64(h + 48, leaves.size());
+  putU64(h + 56, ROOT_MAX);  putU64(h + 64, tileBytes);
+  putU64(h + 72, rows.size());  putU64(h + 80, entries.size());  putU64(h + 88, ncontents);
+  h[96] = 1;  // clustered
+  h[97] = COMPRESS_GZIP;  // directories and metadata
+  h[98] = COMPRESS_GZIP;  // tiles
+  h[99] = TILETYPE_MVT;
+  h[100] = char(minZ);  h[101] = char(maxZ);
+  double lng0 = tileLng(minX, maxZ), lng1 = tileLng(maxX + 1, maxZ);
+  double lat0 = tileLat(maxY + 1, maxZ), lat1 = tileLat(minY, maxZ);
+  putI32(h + 102, int32_t(lng0*1E7));  putI32(h + 106, int32_t(lat0*1E7));
+  putI32(h + 110, int32_t(lng1*1E7));  putI32(h + 114, int32_t(lat1*1E7));
+  h[118] = char(minZ);
+  putI32(h + 119, int32_t((lng0 + lng1)/2*1E7));  putI32(h + 123, int32_t((lat0 + lat1)/2*1E7));
+  ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(h, HEADER_SIZE, 1, f) == 1 && fwrite(root.data(), root.size(), 1, f) == 1;
+  if(fclose(f) != 0 || !ok) {
+    LOG("Error writing tile archive %s", archivePath);
+    return -1;
+  }
+  double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  LOG("Exported %lu tiles (%lu entries, %lu unique) from %s to %s in %.0f s: %.1f MB tile data, %d KB leaf directories",
+      (unsigned long)rows.size(), (unsigned long)entries.size(), (unsigned long)ncontents, dbPath, archivePath, dt,
+      tileBytes/1048576.0, int(leaves.size()/1024));
+  return 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include "tileId.h"
+
+// read-only tile archive in PMTiles v3 format (https://github.com/protomaps/PMTiles/blob/main/spec/v3/spec.md),
+//  exported from a fully built mbtiles file (server --export), so pre-built tiles can be served by the server
+//  from a memory mapped file or by any PMTiles reader (e.g., from a CDN or object store)
+// - tiles are clustered in Hilbert order (PMTiles tile id), so tiles near each other on the map are near each
+//  other in the file; identical small tiles (mostly ocean and land) are stored once
+// - all directory entries are decoded into one sorted vector on open, so lookup is a binary search w/o locks;
+//  tile data is served directly from the mapping
+class TileArchive
+{
+public:
+  ~TileArchive();
+  bool open(const char* path);
+  // tile data (gzip MVT) in mapped file, or false if tile is not in archive
+  bool find(TileID id, std::string_view& data) const;
+  bool contains(TileID id) const { std::string_view data;  return find(id, data); }
+  size_t count() const { return m_numTiles; }  // addressed tiles
+  size_t bytes() const { return m_size; }
+
+  static uint64_t tileId(TileID id);  // PMTiles tile id: tiles at lower zooms, then Hilbert index at zoom
+
+  // directory entry: runLength tiles from tileId w/ same data, or leaf directory if runLength == 0
+  struct Entry { uint64_t tileId; uint64_t offset; uint32_t length; uint32_t runLength; };
+
+private:
+  std::vector<Entry> m_entries;  // tile entries of root and leaf directories, sorted by tile id
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+  uint64_t m_tileDataOffset = 0, m_tileDataLength = 0;
+  size_t m_numTiles = 0;
+
+  bool readDirectory(std::string_view dir, int compression, uint64_t leafOffset, int depth);
+};
+
+// write all (non-empty) tiles of mbtiles file to archive; returns 0 on success
+int exportArchive(const char* dbPath, const char* archivePath);
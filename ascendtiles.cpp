@@ -2,6 +2,7 @@
 
 #include "tilebuilder.h"
 
+#include <mutex>
 #include <string>
 #include <unordered_set>
 #include <unordered_map>
@@ -31,16 +32,31 @@ public:
   void WriteProtectedArea();
 };
 
-std::string buildTile(const Features& world, const Features& ocean, TileID id)
+std::string buildTile(const Features& world, const Features& ocean, TileID id,
+    TileGeomStore* geomOut, const std::vector<const TileGeomStore*>& geomIn)
 {
-  AscendTileBuilder tileBuilder(id);
-  try {
-    return tileBuilder.build(world, ocean);
-  }
-  catch(std::exception &e) {
-    int64_t fid = tileBuilder.m_feat ? tileBuilder.m_featId : -1;  //tileBuilder.feature().id() : -1;
-    LOG("Exception building tile %s (feature id %ld): %s", id.toString().c_str(), fid, e.what());
-    return "";
+  static constexpr int MAX_BUDGET_REBUILDS = 2;
+  for(int maxRank = INT_MAX, attempt = 0;; ++attempt) {
+    AscendTileBuilder tileBuilder(id);
+    tileBuilder.m_geomOut = geomOut;
+    tileBuilder.m_geomIn = geomIn;
+    tileBuilder.m_maxRank = maxRank;
+    try {
+      std::string mvt = tileBuilder.build(world, ocean);
+      int rank = attempt < MAX_BUDGET_REBUILDS ? tileBuilder.budgetRank(mvt.size()) : -1;
+      if(attempt == 0 && TileBuilder::maxTileBytes && mvt.size() > TileBuilder::maxTileBytes)
+        ++TileBuilder::overBudgetTiles;
+      if(rank < 0) { return mvt; }
+      LOG("Tile %s (%d bytes) over budget; rebuilding w/ features to zoom rank %d",
+          id.toString().c_str(), int(mvt.size()), rank);
+      maxRank = rank;
+      if(geomOut) { geomOut->feats.clear();  geomOut->lines.clear();  geomOut->areas.clear(); }
+    }
+    catch(std::exception &e) {
+      int64_t fid = tileBuilder.m_feat ? tileBuilder.m_featId : -1;  //tileBuilder.feature().id() : -1;
+      LOG("Exception building tile %s (feature id %ld): %s", id.toString().c_str(), fid, e.what());
+      return "";
+    }
   }
 }
 
@@ -55,22 +71,60 @@ std::string buildTile(const Features& world, const Features& ocean, TileID id)
 //  LOG("%s", s.c_str());
 //}
 
-// we could try something like github.com/serge-sans-paille/frozen or github.com/renzibei/fph-table for
-//  the set/map here, but at this point, tag lookup is only a small part of CPU time
-struct Set {
+// Set and ZMap values are compiled to GOL global string codes by compileTagMatchers() once GOL is loaded, so
+//  matching a tag value that is a global string (nearly all common values) is just an array lookup; other
+//  values (local strings, numbers) fall back to string hash lookup
+// - all matchers register themselves (incl. copies) so they can be compiled w/o listing them
+// - codes are kept for each GolVersion slot, and compiled for the current GOL version
+struct TagMatcher {
+  TagMatcher() { std::lock_guard<std::mutex> lock(registryMutex());  registry().insert(this); }
+  TagMatcher(const TagMatcher&) : TagMatcher() {}
+  virtual ~TagMatcher() { std::lock_guard<std::mutex> lock(registryMutex());  registry().erase(this); }
+  virtual void compile() = 0;
+
+  static std::unordered_set<TagMatcher*>& registry() { static std::unordered_set<TagMatcher*> r;  return r; }
+  static std::mutex& registryMutex() { static std::mutex m;  return m; }
+};
+
+void compileTagMatchers()
+{
+  std::lock_guard<std::mutex> lock(TagMatcher::registryMutex());
+  for(TagMatcher* m : TagMatcher::registry()) { m->compile(); }
+}
+
+struct Set : public TagMatcher {
   std::unordered_set<std::string> m_items;
+  std::vector<bool> m_slotCodes[GolVersion::NUM_SLOTS];  // by global string code
   Set(std::initializer_list<std::string> items) : m_items(items) {}
 
+  void compile() override {
+    std::vector<bool>& codes = m_slotCodes[GolVersion::current().slot()];
+    codes.clear();
+    for(const std::string& s : m_items) {
+      int code = TileBuilder::getStringCode(s);
+      if(code < 0) { continue; }
+      if(size_t(code) >= codes.size()) { codes.resize(code + 1); }
+      codes[code] = true;
+    }
+  }
+
   bool operator[](const std::string& key) const { return !key.empty() && m_items.find(key) != m_items.end(); }
-  bool operator[](const TagValue& key) const { return bool(key) && m_items.find(std::string(key)) != m_items.end(); }
+  bool operator[](const TagValue& key) const {
+    if(!key) { return false; }
+    int code = TileBuilder::globalStringCode(key);
+    const std::vector<bool>& codes = m_slotCodes[GolVersion::current().slot()];
+    if(code >= 0) { return size_t(code) < codes.size() && codes[code]; }
+    return m_items.find(std::string(key)) != m_items.end();
+  }
 };
 
 static constexpr int EXCLUDE = 100;
-struct ZMap {
+struct ZMap : public TagMatcher {
   using map_t = std::unordered_map<std::string, int>;
   std::string m_tag;
-  mutable CodedString m_tagCode;  // = {{}, INT_MAX};
+  CodedString m_tagCodes[GolVersion::NUM_SLOTS];  // = {{}, INT_MAX};
   map_t m_items;
+  std::vector<int> m_slotCodes[GolVersion::NUM_SLOTS];  // value by global string code
   const int m_dflt = EXCLUDE;
   ZMap(std::string_view _tag, int _dflt=EXCLUDE) : m_tag(_tag), m_dflt(_dflt) {}
   ZMap(std::initializer_list<map_t::value_type> items) : m_items(items) {}
@@ -80,23 +134,41 @@ struct ZMap {
     return *this;
   }
 
-  const std::string& tag() const { return m_tag; }
-  const CodedString& tagCode() const {
-    if(m_tagCode.isNull())
-      m_tagCode = TileBuilder::getCodedString(m_tag);
-    return m_tagCode;
+  void compile() override {
+    int slot = GolVersion::current().slot();
+    if(!m_tag.empty()) { m_tagCodes[slot] = TileBuilder::getCodedString(m_tag); }
+    std::vector<int>& codes = m_slotCodes[slot];
+    codes.clear();
+    for(auto& item : m_items) {
+      int code = TileBuilder::getStringCode(item.first);
+      if(code < 0) { continue; }
+      if(size_t(code) >= codes.size()) { codes.resize(code + 1, m_dflt); }
+      codes[code] = item.second;
+    }
   }
 
+  const std::string& tag() const { return m_tag; }
+  const CodedString& tagCode() const { return m_tagCodes[GolVersion::current().slot()]; }
+
   int getValue(const std::string& key) const {
     auto it = m_items.find(key);
     return it != m_items.end() ? it->second : m_dflt;
   }
 
   int operator[](const std::string& key) const { return !key.empty() ? getValue(key) : m_dflt; }
-  int operator[](const TagValue& key) const { return key ? getValue(key) : m_dflt; }
+  int operator[](const TagValue& key) const {
+    if(!key) { return m_dflt; }
+    int code = TileBuilder::globalStringCode(key);
+    const std::vector<int>& codes = m_slotCodes[GolVersion::current().slot()];
+    if(code >= 0) { return size_t(code) < codes.size() ? codes[code] : m_dflt; }
+    return getValue(key);
+  }
 };
 
 
+// layer handles for Layer(), in order of ascendLayers
+enum AscendLayer { LAYER_PLACE, LAYER_BOUNDARY, LAYER_POI, LAYER_TRANSPORTATION, LAYER_TRANSIT, LAYER_BUILDING,
+    LAYER_WATER, LAYER_LANDUSE };
 static const std::vector<std::string> ascendLayers =
     { "place", "boundary", "poi", "transportation", "transit", "building", "water", "landuse" };
 
@@ -118,12 +190,17 @@ AscendTileBuilder::AscendTileBuilder(TileID _id) : TileBuilder(_id, ascendLayers
     else if (m_id.z >= 6) { m_queries.push_back("w[highway=motorway,trunk]"); }
     else if (m_id.z >= 4) { m_queries.push_back("w[highway=motorway]"); }
   }
+  // combine unnamed roads, waterways, etc. w/ same attributes at lower zooms (each z14 feature is kept separate
+  //  so it can be picked in app)
+  if (m_id.z < 14) {
+    for (int l : {LAYER_TRANSPORTATION, LAYER_WATER, LAYER_LANDUSE}) { m_layerBuilds[l]->merge = true; }
+  }
 }
 
 void AscendTileBuilder::processFeature()
 {
   if(m_featId == OCEAN_ID) {  // building ocean polygon?
-    Layer("water", true);
+    Layer(LAYER_WATER, true);
     Attribute("water", "ocean");
   }
   else if (feature().isWay()) { ProcessWay(); }
@@ -158,7 +235,7 @@ void AscendTileBuilder::ProcessNode()
 
     if (!MinZoom(mz)) { return; }
 
-    Layer("place", false);
+    Layer(LAYER_PLACE, false);
     Attribute("place", place);
     Attribute("ref", Find("ref"));
     Attribute("capital", Find("capital"));
@@ -197,7 +274,7 @@ void AscendTileBuilder::ProcessNode()
     else if (prominence > 2500) { mz = 9; }
     else if (prominence > 2000) { mz = 10; }
     if (!MinZoom(mz)) { return; }
-    Layer("poi", false);
+    Layer(LAYER_POI, false);
     SetNameAttributes();
     SetIdAttributes();
     SetEleAttributes();
@@ -209,7 +286,7 @@ void AscendTileBuilder::ProcessNode()
   }
   else if (natural == "bay") {
     if (!MinZoom(8)) { return; }
-    Layer("water", false);
+    Layer(LAYER_WATER, false);
     SetNameAttributes();  //14);
     return;
   }
@@ -280,15 +357,15 @@ void AscendTileBuilder::ProcessRelation()
     auto route = Find("route");
     if (route == "ferry") {
       if(!MinZoom(9)) { return; }
-      Layer("transportation", false);
+      Layer(LAYER_TRANSPORTATION, false);
       Attribute("route", "ferry");
       SetNameAttributes(12);
       return;
     }
     if (MinZoom(transitRoutes[route])) {
-      Layer("transit", false);
+      Layer(LAYER_TRANSIT, false);
     } else if (MinZoom(otherRoutes[route])) {
-      Layer("transportation", false);
+      Layer(LAYER_TRANSPORTATION, false);
     } else {
       return;
     }
@@ -320,12 +397,12 @@ void AscendTileBuilder::ProcessWay()
     if (!MinZoom(12)) { return; }
     // current stylus-osm.yaml doesn't show any buildings below z14
     if (MinZoom(14)) {  // SetMinZoomByArea()) {
-      Layer("building", true);
+      Layer(LAYER_BUILDING, true);
       SetBuildingHeightAttributes();
       // housenumber is also commonly set on poi nodes, but not very useful w/o at least street name too
       Attribute("housenumber", Find("addr:housenumber"));  //if (MinZoom(14)) {  }
     }
-    NewWritePOI(0, MinZoom(14));
+    NewWritePOI(0, ZoomAtLeast(14));
     return;
   }
 
@@ -359,7 +436,7 @@ void AscendTileBuilder::ProcessWay()
     if (highway == "footway" && Find("footway")) { return; }
     if (isClosed && !SetMinZoomByArea()) { return; }
 
-    Layer("transportation", false);
+    Layer(LAYER_TRANSPORTATION, false);
     Attribute("highway", highway);
     SetBrunnelAttributes();
     if (ramp) { AttributeNumeric("ramp", 1); }
@@ -436,7 +513,7 @@ void AscendTileBuilder::ProcessWay()
     auto service = Find("service");
     if (!MinZoom(service ? 12 : 9)) { return; }
     if (isClosed && !SetMinZoomByArea()) { return; }  // platforms mostly
-    Layer("transportation", false);
+    Layer(LAYER_TRANSPORTATION, false);
     Attribute("railway", railway);
     SetBrunnelAttributes();
     SetNameAttributes(14);
@@ -451,7 +528,7 @@ void AscendTileBuilder::ProcessWay()
   else if (waterwayClasses[waterway] && !isClosed) {
     bool namedriver = waterway == "river" && Holds("name");
     if (!MinZoom(namedriver ? 8 : 12)) { return; }
-    Layer("water", false);  //waterway , waterway_detail
+    Layer(LAYER_WATER, false);  //waterway , waterway_detail
     if (Find("intermittent") == "yes") { AttributeNumeric("intermittent", 1); }
     //Attribute("class", waterway);
     Attribute("waterway", waterway);
@@ -460,7 +537,7 @@ void AscendTileBuilder::ProcessWay()
     return;
   } else if (waterway == "dam") {
     if (!MinZoom(12)) { return; }  // was 13
-    Layer("building", isClosed);
+    Layer(LAYER_BUILDING, isClosed);
     Attribute("waterway", waterway);
     return;
   } else if (waterway == "boatyard" || waterway == "fuel") {
@@ -479,7 +556,7 @@ void AscendTileBuilder::ProcessWay()
     auto water = Find("water");
     if (water) { waterbody = std::string(water); }
     bool intermittent = Find("intermittent") == "yes";
-    Layer("water", true);
+    Layer(LAYER_WATER, true);
     Attribute("water", waterbody);
 
     if (intermittent) { AttributeNumeric("intermittent", 1); }
@@ -488,7 +565,7 @@ void AscendTileBuilder::ProcessWay()
       SetNameAttributes();  //14);  -- minzoom was broken in tilemaker script!
       AttributeNumeric("area", Area());
       // point for name
-      LayerAsCentroid("water");
+      LayerAsCentroid(LAYER_WATER);
       Attribute("water", waterbody);
       SetNameAttributes();
       AttributeNumeric("area", Area());
@@ -500,7 +577,7 @@ void AscendTileBuilder::ProcessWay()
   if (natural) {
     if (natural == "bay") {
       if (!MinZoom(8)) { return; }
-      LayerAsCentroid("water");
+      LayerAsCentroid(LAYER_WATER);
       SetNameAttributes();
       AttributeNumeric("area", Area());
       return;
@@ -509,7 +586,7 @@ void AscendTileBuilder::ProcessWay()
       auto len = Length();
       double area = isClosed ? Area() : len*len;
       if (!SetMinZoomByArea(area)) { return; }
-      Layer("landuse", false);
+      Layer(LAYER_LANDUSE, false);
       Attribute("natural", natural);
       SetNameAttributes();
       AttributeNumeric("area", area);  // to support filtering by length in scene file
@@ -536,7 +613,7 @@ void AscendTileBuilder::ProcessWay()
   auto place = Find("place");
   if (placeAreas[place]) {
     if (!SetMinZoomByArea()) { return; }
-    LayerAsCentroid("place");
+    LayerAsCentroid(LAYER_PLACE);
     Attribute("place", place);
     SetNameAttributes();
     SetIdAttributes();
@@ -553,7 +630,7 @@ void AscendTileBuilder::ProcessWay()
 
   if (landuseAreas[landuse] || naturalAreas[natural] || leisureAreas[leisure] || amenityAreas[amenity] || tourismAreas[tourism]) {
     if (!SetMinZoomByArea()) { return; }
-    Layer("landuse", true);
+    Layer(LAYER_LANDUSE, true);
     Attribute("landuse", landuse);
     Attribute("natural", natural);
     Attribute("leisure", leisure);
@@ -573,7 +650,7 @@ void AscendTileBuilder::ProcessWay()
   auto man_made = Find("man_made");
   if (manMadeClasses[man_made]) {
     if(!SetMinZoomByArea()) { return; }
-    Layer("landuse", isClosed);
+    Layer(LAYER_LANDUSE, isClosed);
     //SetZOrder(way);
     Attribute("man_made", man_made);
     return;
@@ -586,7 +663,7 @@ void AscendTileBuilder::ProcessWay()
     // parents() not implemented! ... we'll assume a parent has route=ferry if any parents
     if (feature().belongsToRelation()) { return; }  // avoid duplication
     //for (Relation rel : feature().parents()) { if (rel["route"] == "ferry") { return; }  }
-    Layer("transportation", false);
+    Layer(LAYER_TRANSPORTATION, false);
     Attribute("route", route);
     SetBrunnelAttributes();
     SetNameAttributes(12);
@@ -596,7 +673,7 @@ void AscendTileBuilder::ProcessWay()
   auto piste_diff = Find("piste:difficulty");
   if (piste_diff) {  // != "") {
     if (!MinZoom(10)) { return; }
-    Layer("transportation", isClosed);
+    Layer(LAYER_TRANSPORTATION, isClosed);
     Attribute("route", "piste");
     Attribute("difficulty", piste_diff);
     Attribute("piste_type", Find("piste:type"));
@@ -608,7 +685,7 @@ void AscendTileBuilder::ProcessWay()
   auto aerialway = Find("aerialway");
   if (aerialway) {  // != "") {
     if (!MinZoom(10)) { return; }
-    Layer("transportation", false);
+    Layer(LAYER_TRANSPORTATION, false);
     Attribute("aerialway", aerialway);
     SetNameAttributes(14);
     return;
@@ -617,7 +694,7 @@ void AscendTileBuilder::ProcessWay()
   auto aeroway = Find("aeroway");
   if (aerowayBuildings[aeroway]) {
     if (!SetMinZoomByArea()) { return; }
-    Layer("building", true);
+    Layer(LAYER_BUILDING, true);
     Attribute("aeroway", aeroway);
     SetBuildingHeightAttributes();
     if (MinZoom(14)) { NewWritePOI(0, true); }
@@ -626,7 +703,7 @@ void AscendTileBuilder::ProcessWay()
   if (aerowayClasses[aeroway]) {
     if (!MinZoom(10)) { return; }
     if (isClosed && !SetMinZoomByArea()) { return; }
-    Layer("transportation", isClosed);  //"aeroway"
+    Layer(LAYER_TRANSPORTATION, isClosed);  //"aeroway"
     Attribute("aeroway", aeroway);
     if (aeroway == "aerodrome") {
       Attribute("aerodrome", Find("aerodrome"));
@@ -692,7 +769,7 @@ bool AscendTileBuilder::NewWritePOI(double area, bool force)
   }
   if(!writepoi) { return false; }
 
-  LayerAsCentroid("poi");
+  LayerAsCentroid(LAYER_POI);
   SetNameAttributes();
   SetIdAttributes();
   // provide area to help rank important POIs
@@ -715,7 +792,7 @@ bool AscendTileBuilder::NewWritePOI(double area, bool force)
 
 void AscendTileBuilder::SetNameAttributes(int minz)
 {
-  if (!MinZoom(minz)) { return; }
+  if (!ZoomAtLeast(minz)) { return; }
   auto name = Find("name");
   Attribute("name", name);
   auto name_en_tag = Find("name:en");
@@ -764,10 +841,15 @@ bool AscendTileBuilder::SetMinZoomByArea(double area)
   if (int64_t(bounds.maxY()) - int64_t(bounds.minY()) > maxH) { return false; }
   if (MinZoom(14)) { return true; }  // skip area calc for highest zoom
   double minarea = squared(MapProjection::metersPerTileAtZoom(m_id.z - 1)/256.0);
-  if (area > 0) { return area >= minarea; }
-  // bbox area sets upper limit on feature area
-  if (bounds.area() < minarea) { return false; }
-  return Area() >= minarea;
+  if (area <= 0) {
+    // bbox area sets upper limit on feature area
+    if (bounds.area() < minarea) { return false; }
+    area = Area();
+  }
+  if (area < minarea) { return false; }
+  // zoom rank is lowest zoom at which area passes (minarea shrinks 4x per zoom), so small areas drop first
+  double z0area = squared(MapProjection::metersPerTileAtZoom(0)/256.0);
+  return MinZoom(std::clamp(int(std::ceil(1 + 0.5*std::log2(z0area/area))), 0, int(m_id.z)));
 }
 
 void AscendTileBuilder::SetBuildingHeightAttributes()
@@ -802,7 +884,7 @@ void AscendTileBuilder::SetBuildingHeightAttributes()
 
 void AscendTileBuilder::WriteAerodromePOI()
 {
-  LayerAsCentroid("transportation");
+  LayerAsCentroid(LAYER_TRANSPORTATION);
   Attribute("aeroway", "aerodrome");
   Attribute("aerodrome", Find("aerodrome"));
   SetNameAttributes();
@@ -824,7 +906,7 @@ void AscendTileBuilder::WriteProtectedArea()
   auto protect_class = Find("protect_class");
   // convert "access" to string since bool() will return false for access=no
   std::string access = Find("access");  // probably should just not write private areas
-  Layer("landuse", true);
+  Layer(LAYER_LANDUSE, true);
   Attribute("boundary", boundary);
   Attribute("landuse", Find("landuse"));  // write landuse tags instead of duplicating feature
   Attribute("natural", Find("natural"));
@@ -865,7 +947,7 @@ void AscendTileBuilder::WriteBoundary()
   bool maritime = Find("maritime") == "yes";
   bool disputed = boundary == "disputed" || Find("disputed") == "yes";
   if (feature().isWay()) {
-    Layer("boundary", false);
+    Layer(LAYER_BOUNDARY, false);
     Attribute("boundary", boundary);
     if (admin_level >= 0) { AttributeNumeric("admin_level", admin_level); }
     SetNameAttributes();
@@ -889,7 +971,7 @@ void AscendTileBuilder::WriteBoundary()
       // combining members view and bounded view is currently a "TODO" in libgeodesk, so check manually
       if (!m_tileBox.intersects(f.bounds())) { continue; }
       setFeature(f);
-      Layer("boundary", false);
+      Layer(LAYER_BOUNDARY, false);
       Attribute("boundary", boundary);
       if (admin_level >= 0) { AttributeNumeric("admin_level", admin_level); }
       Attribute("name", name);
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// per-stage tile build timing: time spent in each stage is summed over a tile, then recorded in a histogram
+//  by stage and zoom; stages are inclusive, e.g., process includes area, clip, simplify, and polylabel
+// - each thread writes only to its own block of counters, so recording requires no locks or atomic RMW
+enum BuildStage { STAGE_QUERY = 0, STAGE_PROCESS, STAGE_AREA, STAGE_CLIP, STAGE_SIMPLIFY, STAGE_POLYLABEL,
+    STAGE_ENCODE, STAGE_GZIP, STAGE_TOTAL, NUM_STAGES };
+
+class BuildStats
+{
+public:
+  static constexpr int NUM_ZOOMS = 21;
+  static constexpr int NUM_BUCKETS = 20;  // upper bounds are 2^(i-4) ms, plus +Inf bucket
+  static constexpr const char* stageNames[NUM_STAGES] = {
+      "query", "process", "area", "clip", "simplify", "polylabel", "encode", "gzip", "total" };
+
+  static void record(int zoom, const uint64_t* stageNs);
+  static std::string prometheus();
+  // stage times of last tile recorded on calling thread (for benchmark)
+  static const uint64_t* lastStageNs() { return lastNs; }
+
+private:
+  struct Block {
+    std::atomic_bool inUse = true;
+    std::atomic_uint_fast64_t counts[NUM_STAGES][NUM_ZOOMS][NUM_BUCKETS + 1] = {};
+    std::atomic_uint_fast64_t sumNs[NUM_STAGES][NUM_ZOOMS] = {};
+  };
+  // releases block for reuse when thread exits
+  struct Handle {
+    Block* block;
+    Handle();
+    ~Handle() { block->inUse = false; }
+  };
+
+  static inline std::mutex blocksMutex;
+  static inline std::vector< std::unique_ptr<Block> > blocks;
+  static inline thread_local uint64_t lastNs[NUM_STAGES] = {};
+
+  static void incr(std::atomic_uint_fast64_t& c, uint64_t n)
+  {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);  // single writer
+  }
+};
+
+// adds elapsed time to accumulator when destroyed
+class StageTimer
+{
+public:
+  StageTimer(uint64_t& acc) : m_acc(acc), m_t0(std::chrono::steady_clock::now()) {}
+  ~StageTimer() { m_acc += std::chrono::nanoseconds(std::chrono::steady_clock::now() - m_t0).count(); }
+
+private:
+  uint64_t& m_acc;
+  std::chrono::steady_clock::time_point m_t0;
+};
+
+inline BuildStats::Handle::Handle()
+{
+  std::lock_guard<std::mutex> lock(blocksMutex);
+  for(auto& b : blocks) {
+    bool free = false;
+    if(b->inUse.compare_exchange_strong(free, true)) { block = b.get();  return; }
+  }
+  blocks.push_back(std::make_unique<Block>());
+  block = blocks.back().get();
+}
+
+inline void BuildStats::record(int zoom, const uint64_t* stageNs)
+{
+  static thread_local Handle handle;
+  Block& b = *handle.block;
+  zoom = std::max(0, std::min(zoom, NUM_ZOOMS - 1));
+  std::copy_n(stageNs, int(NUM_STAGES), lastNs);
+  for(int ii = 0; ii < NUM_STAGES; ++ii) {
+    // bucket i has upper bound 2^(i-4) ms = 2^(i-4) * 1E6 ns; 62500 ns for i = 0
+    uint64_t t = stageNs[ii]/62500;
+    int bucket = 0;
+    while(t > 0 && bucket < NUM_BUCKETS) { t >>= 1;  ++bucket; }
+    incr(b.counts[ii][zoom][bucket], 1);
+    incr(b.sumNs[ii][zoom], stageNs[ii]);
+  }
+}
+
+// Prometheus text exposition format; only zooms w/ at least one tile are included
+inline std::string BuildStats::prometheus()
+{
+  std::string out = "# HELP tile_build_stage_seconds Time per tile spent in each build stage\n"
+      "# TYPE tile_build_stage_seconds histogram\n";
+  std::lock_guard<std::mutex> lock(blocksMutex);
+  for(int stage = 0; stage < NUM_STAGES; ++stage) {
+    for(int z = 0; z < NUM_ZOOMS; ++z) {
+      uint64_t counts[NUM_BUCKETS + 1] = {}, sumNs = 0, total = 0;
+      for(auto& b : blocks) {
+        for(int ii = 0; ii <= NUM_BUCKETS; ++ii) { counts[ii] += b->counts[stage][z][ii].load(std::memory_order_relaxed); }
+        sumNs += b->sumNs[stage][z].load(std::memory_order_relaxed);
+      }
+      for(uint64_t c : counts) { total += c; }
+      if(total == 0) { continue; }
+      std::string labels = std::string("stage=\"") + stageNames[stage] + "\",zoom=\"" + std::to_string(z) + "\"";
+      uint64_t cum = 0;
+      char buf[256];
+      for(int ii = 0; ii < NUM_BUCKETS; ++ii) {
+        cum += counts[ii];
+        snprintf(buf, sizeof(buf), "tile_build_stage_seconds_bucket{%s,le=\"%g\"} %lu\n",
+            labels.c_str(), std::ldexp(1E-3, ii - 4), (unsigned long)cum);
+        out += buf;
+      }
+      snprintf(buf, sizeof(buf), "tile_build_stage_seconds_bucket{%s,le=\"+Inf\"} %lu\n"
+          "tile_build_stage_seconds_sum{%s} %.6f\ntile_build_stage_seconds_count{%s} %lu\n", labels.c_str(),
+          (unsigned long)total, labels.c_str(), sumNs*1E-9, labels.c_str(), (unsigned long)total);
+      out += buf;
+    }
+  }
+  return out;
+}
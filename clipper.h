@@ -75,13 +75,27 @@ public:
     }
 
     vt_linear_ring operator()(const vt_linear_ring& ring) const {
-        return clipRing(ring);
+        vt_linear_ring slice;
+        clipRing(ring, slice);
+        return slice;
+    }
+
+    // versions writing to existing containers, so caller can reuse buffers; out is cleared first
+    void operator()(const vt_linear_ring& ring, vt_linear_ring& out) const {
+        clipRing(ring, out);
+    }
+
+    void operator()(const vt_multi_line_string& lines, vt_multi_line_string& out) const {
+        out.clear();
+        for (const auto& line : lines) {
+            clipLine(line, out);
+        }
     }
 
     vt_polygon operator()(const vt_polygon& polygon) const {
         vt_polygon result;
         for (const auto& ring : polygon) {
-            const auto new_ring = clipRing(ring);
+            const auto new_ring = (*this)(ring);
             if (!new_ring.empty())
                 result.push_back(new_ring);
         }
@@ -93,7 +107,7 @@ public:
         for (const auto& polygon : polygons) {
             vt_polygon p;
             for (const auto& ring : polygon) {
-                const auto new_ring = clipRing(ring);
+                const auto new_ring = (*this)(ring);
                 if (!new_ring.empty())
                     p.push_back(new_ring);
             }
@@ -171,14 +185,14 @@ private:
         newSlice(slices, slice);  //, dist);
     }
 
-    vt_linear_ring clipRing(const vt_linear_ring& ring) const {
+    void clipRing(const vt_linear_ring& ring, vt_linear_ring& slice) const {
         const size_t len = ring.size();
 
-        vt_linear_ring slice;
+        slice.clear();
         //slice.area = ring.area;
 
         if (len < 2)
-            return slice;
+            return;
 
         for (size_t i = 0; i < (len - 1); ++i) {
             const auto& a = ring[i];
@@ -220,7 +234,5 @@ private:
                 slice.push_back(first);
             }
         }
-
-        return slice;
     }
 };
@@ -0,0 +1,292 @@
+#include "compress.h"
+#include <algorithm>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#else
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "miniz/miniz.h"
+#endif
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+// default incremental compression just collects input
+
+struct StreamBuffer {
+  std::string in;
+  int level = 0;
+};
+static thread_local StreamBuffer streamBuf;
+
+void TileCompressor::begin(int level)
+{
+  streamBuf.in.clear();
+  streamBuf.level = level;
+}
+
+bool TileCompressor::add(std::string_view in)
+{
+  streamBuf.in.append(in);
+  return true;
+}
+
+bool TileCompressor::finish(std::string& out)
+{
+  return compress(streamBuf.in, out, streamBuf.level);
+}
+
+// gzip
+
+static void storLE32(uint8_t* p, uint32_t n)
+{
+  p[0] = n >> 0;  p[1] = n >> 8;  p[2] = n >> 16;  p[3] = n >> 24;
+}
+
+static uint32_t loadLE32(const uint8_t* p)
+{
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+#ifdef USE_LIBDEFLATE
+class LibdeflateGzip : public TileCompressor
+{
+public:
+  static constexpr int MAX_LEVEL = 12;
+
+  const char* encoding() const override { return "gzip"; }
+
+  bool compress(std::string_view in, std::string& out, int level) override
+  {
+    // compressor objects are not thread safe and are expensive to create, so keep one per level per thread
+    struct Compressors {
+      libdeflate_compressor* c[MAX_LEVEL + 1] = {};
+      ~Compressors() { for(auto p : c) { if(p) { libdeflate_free_compressor(p); } } }
+    };
+    static thread_local Compressors compressors;
+    static thread_local std::string buf;  // reused so only compressed bytes are copied to out
+    level = std::max(0, std::min(level, MAX_LEVEL));
+    libdeflate_compressor*& c = compressors.c[level];
+    if(!c) { c = libdeflate_alloc_compressor(level); }
+    if(!c) { return false; }
+    buf.resize(libdeflate_gzip_compress_bound(c, in.size()));
+    size_t n = libdeflate_gzip_compress(c, in.data(), in.size(), buf.data(), buf.size());
+    out.assign(buf.data(), n);
+    return n > 0;
+  }
+
+  bool decompress(std::string_view in, std::string& out) override
+  {
+    static thread_local std::unique_ptr<libdeflate_decompressor, void(*)(libdeflate_decompressor*)> d(
+        libdeflate_alloc_decompressor(), libdeflate_free_decompressor);
+    if(!d || in.size() < 18) { return false; }
+    // gzip footer has uncompressed size mod 2^32
+    out.resize(std::max(size_t(loadLE32((const uint8_t*)in.data() + in.size() - 4)), in.size()*4));
+    for(;;) {
+      size_t n = 0;
+      auto res = libdeflate_gzip_decompress(d.get(), in.data(), in.size(), out.data(), out.size(), &n);
+      if(res == LIBDEFLATE_SUCCESS) { out.resize(n);  return true; }
+      if(res != LIBDEFLATE_INSUFFICIENT_SPACE) { return false; }
+      out.resize(out.size()*2);
+    }
+  }
+};
+#else
+// deflate state (~300KB) and output buffer are reused for all tiles built by a thread
+class MinizGzip : public TileCompressor
+{
+public:
+  const char* encoding() const override { return "gzip"; }
+
+  bool compress(std::string_view in, std::string& out, int level) override
+  {
+    begin(level);
+    return add(in) && finish(out);
+  }
+
+  void begin(int level) override
+  {
+    Stream& st = stream;
+    if(st.init && st.level != level) { mz_deflateEnd(&st.s);  st.init = false; }
+    if(!st.init) {
+      memset(&st.s, 0, sizeof(mz_stream));
+      st.init = mz_deflateInit2(&st.s, level, MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 6, MZ_DEFAULT_STRATEGY) == MZ_OK;
+      st.level = level;
+    }
+    else
+      mz_deflateReset(&st.s);
+    st.crc = MZ_CRC32_INIT;
+    st.len = 0;
+    st.buf.resize(std::max(st.buf.size(), size_t(1) << 16));
+    // gzip header: magic, method = deflate, flags, mtime, xfl, OS
+    const uint8_t hdr[10] = { 0x1F, 0x8B, 8, 0, 0,0,0,0, 0, 0xFF };
+    memcpy(st.buf.data(), hdr, 10);
+    st.nout = 10;
+  }
+
+  bool add(std::string_view in) override
+  {
+    Stream& st = stream;
+    st.crc = mz_crc32(st.crc, (const uint8_t*)in.data(), in.size());
+    st.len += in.size();
+    st.s.next_in = (const uint8_t*)in.data();
+    st.s.avail_in = in.size();
+    return st.init && deflate(MZ_NO_FLUSH);
+  }
+
+  bool finish(std::string& out) override
+  {
+    Stream& st = stream;
+    if(!st.init || !deflate(MZ_FINISH)) { return false; }
+    if(st.buf.size() < st.nout + 8) { st.buf.resize(st.nout + 8); }
+    storLE32((uint8_t*)st.buf.data() + st.nout, st.crc);
+    storLE32((uint8_t*)st.buf.data() + st.nout + 4, st.len);
+    out.assign(st.buf.data(), st.nout + 8);
+    return true;
+  }
+
+  bool decompress(std::string_view in, std::string& out) override
+  {
+    const uint8_t* p = (const uint8_t*)in.data();
+    size_t n = in.size(), pos = 10;
+    if(n < 18 || p[0] != 0x1F || p[1] != 0x8B || p[2] != 8) { return false; }
+    uint8_t flags = p[3];
+    if(flags & 4) { pos += 2 + (p[10] | p[11] << 8); }  // FEXTRA
+    if(flags & 8) { while(pos < n && p[pos++]) {} }  // FNAME
+    if(flags & 16) { while(pos < n && p[pos++]) {} }  // FCOMMENT
+    if(flags & 2) { pos += 2; }  // FHCRC
+    if(pos + 8 > n) { return false; }
+
+    mz_stream s;
+    memset(&s, 0, sizeof(mz_stream));
+    if(mz_inflateInit2(&s, -MZ_DEFAULT_WINDOW_BITS) != MZ_OK) { return false; }
+    out.resize(std::max(size_t(loadLE32(p + n - 4)), size_t(1024)));
+    s.next_in = p + pos;
+    s.avail_in = n - 8 - pos;
+    int res;
+    for(;;) {
+      s.next_out = (uint8_t*)out.data() + s.total_out;
+      s.avail_out = out.size() - s.total_out;
+      res = mz_inflate(&s, MZ_SYNC_FLUSH);
+      if(res == MZ_STREAM_END || (res != MZ_OK && res != MZ_BUF_ERROR) || s.avail_out > 0) { break; }
+      out.resize(out.size()*2);
+    }
+    out.resize(s.total_out);
+    mz_inflateEnd(&s);
+    return res == MZ_STREAM_END && mz_crc32(MZ_CRC32_INIT, (const uint8_t*)out.data(), out.size()) == loadLE32(p + n - 8);
+  }
+
+private:
+  struct Stream {
+    mz_stream s;
+    bool init = false;
+    int level = -1;
+    uint32_t crc = 0;
+    uint32_t len = 0;
+    size_t nout = 0;
+    std::string buf;
+    ~Stream() { if(init) { mz_deflateEnd(&s); } }
+  };
+  static thread_local Stream stream;
+
+  // compress all pending input, growing output buffer as needed
+  bool deflate(int flush)
+  {
+    Stream& st = stream;
+    for(;;) {
+      if(st.buf.size() - st.nout < 1024) { st.buf.resize(st.buf.size()*2); }
+      st.s.next_out = (uint8_t*)st.buf.data() + st.nout;
+      st.s.avail_out = st.buf.size() - st.nout;
+      int res = mz_deflate(&st.s, flush);
+      st.nout = st.buf.size() - st.s.avail_out;
+      if(res == MZ_STREAM_END) { return true; }
+      if(res != MZ_OK && res != MZ_BUF_ERROR) { return false; }
+      if(flush == MZ_NO_FLUSH && st.s.avail_in == 0 && st.s.avail_out > 0) { return true; }
+    }
+  }
+};
+
+thread_local MinizGzip::Stream MinizGzip::stream;
+#endif
+
+TileCompressor* TileCompressor::gzip()
+{
+#ifdef USE_LIBDEFLATE
+  static LibdeflateGzip instance;
+#else
+  static MinizGzip instance;
+#endif
+  return &instance;
+}
+
+// zstd
+
+#ifdef USE_ZSTD
+class ZstdCompressor : public TileCompressor
+{
+public:
+  const char* encoding() const override { return "zstd"; }
+
+  bool compress(std::string_view in, std::string& out, int level) override
+  {
+    static thread_local std::unique_ptr<ZSTD_CCtx, size_t(*)(ZSTD_CCtx*)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    if(!cctx) { return false; }
+    out.resize(ZSTD_compressBound(in.size()));
+    size_t n = ZSTD_compressCCtx(cctx.get(), out.data(), out.size(), in.data(), in.size(), level);
+    if(ZSTD_isError(n)) { return false; }
+    out.resize(n);
+    return true;
+  }
+
+  bool decompress(std::string_view in, std::string& out) override
+  {
+    static thread_local std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    unsigned long long size = ZSTD_getFrameContentSize(in.data(), in.size());
+    // we always compress w/ ZSTD_compressCCtx, which writes content size
+    if(!dctx || size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) { return false; }
+    out.resize(size);
+    size_t n = ZSTD_decompressDCtx(dctx.get(), out.data(), out.size(), in.data(), in.size());
+    if(ZSTD_isError(n)) { return false; }
+    out.resize(n);
+    return true;
+  }
+};
+#endif
+
+TileCompressor* TileCompressor::zstd()
+{
+#ifdef USE_ZSTD
+  static ZstdCompressor instance;
+  return &instance;
+#else
+  return nullptr;
+#endif
+}
+
+// CompressLevels
+
+bool CompressLevels::parse(const char* spec)
+{
+  const char* s = spec;
+  while(*s) {
+    char* end;
+    long a = strtol(s, &end, 10);
+    if(end == s) { return false; }
+    int z0 = 0, level = a;
+    if(*end == ':') {
+      s = end + 1;
+      level = strtol(s, &end, 10);
+      if(end == s) { return false; }
+      z0 = a;
+    }
+    for(int z = std::max(0, z0); z <= MAX_ZOOM; ++z) { m_levels[z] = level; }
+    s = end;
+    if(*s == ',') { ++s; }
+    else if(*s) { return false; }
+  }
+  return true;
+}
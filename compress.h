@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// tile compression backends
+// - compress() and decompress() work on raw buffers; out is assigned w/ exact compressed size (so temporary
+//  buffers are reused and a tile blob doesn't hold unused capacity)
+// - gzip uses libdeflate if built with USE_LIBDEFLATE=1 (much faster than miniz for same ratio), else miniz
+// - zstd is only available if built with USE_ZSTD=1
+class TileCompressor
+{
+public:
+  virtual ~TileCompressor() {}
+  virtual const char* encoding() const = 0;  // Content-Encoding value
+  virtual bool compress(std::string_view in, std::string& out, int level) = 0;
+  virtual bool decompress(std::string_view in, std::string& out) = 0;
+
+  // incremental compression: begin(), add() any number of times, then finish(); only one stream per thread
+  //  at a time; default impl collects input in a thread local buffer and compresses it in finish()
+  virtual void begin(int level);
+  virtual bool add(std::string_view in);
+  virtual bool finish(std::string& out);
+
+  static TileCompressor* gzip();
+  static TileCompressor* zstd();  // returns nullptr if not available
+};
+
+// compression level for each zoom, parsed from spec like "6,12:5" (level 6, but level 5 for z >= 12)
+class CompressLevels
+{
+public:
+  static constexpr int MAX_ZOOM = 24;
+
+  CompressLevels(int level) { for(int& l : m_levels) { l = level; } }
+  bool parse(const char* spec);
+  int operator[](int z) const { return m_levels[z < 0 ? 0 : (z > MAX_ZOOM ? MAX_ZOOM : z)]; }
+
+private:
+  int m_levels[MAX_ZOOM + 1];
+};
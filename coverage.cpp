@@ -0,0 +1,144 @@
+#include "coverage.h"
+#include <cstring>
+
+using namespace geodesk;
+
+static constexpr uint32_t COVER_SIZE = 1u << OceanCoverage::ZOOM;
+static const char COVER_MAGIC[4] = {'O', 'C', 'V', '2'};  // v2: built from ocean polygon edges
+
+// z12 tile index from mercator coord; tile y index increases southward
+static uint32_t coverX(int32_t x) { return (uint32_t(x) ^ 0x80000000u) >> (32 - OceanCoverage::ZOOM); }
+static uint32_t coverY(int32_t y) { return COVER_SIZE - 1 - ((uint32_t(y) ^ 0x80000000u) >> (32 - OceanCoverage::ZOOM)); }
+
+void OceanCoverage::build(const Features& ocean)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  for(int z = 0; z <= ZOOM; ++z) { m_levels[z].assign(((size_t(1) << 2*z) + 3)/4, 0xFF); }  // all UNKNOWN
+
+  // mark z12 tiles touched by bounds of each edge of ocean polygons as mixed, so that each remaining region is
+  //  entirely inside or outside the ocean (coastline ways can't be used, since they stop at the boundary of a
+  //  regional extract and may have gaps); conservative, since a mixed tile is just built normally (edges where
+  //  ocean polygons are split only make some ocean tiles mixed)
+  size_t npolys = 0;
+  for(Feature poly : ocean("a")) {
+    RingsPtr rings = poly.isWay() ? TileBuilder::wayRings(poly) : TileBuilder::assembleRings(poly);
+    for(const AssembledRings::Ring& r : rings->rings) {
+      const int32_t* xs = &rings->x[r.start];
+      const int32_t* ys = &rings->y[r.start];
+      for(size_t ii = 1; ii < r.size; ++ii) {
+        uint32_t x0 = coverX(xs[ii-1]), x1 = coverX(xs[ii]);
+        uint32_t y0 = coverY(ys[ii-1]), y1 = coverY(ys[ii]);
+        for(uint32_t y = std::min(y0, y1); y <= std::max(y0, y1); ++y) {
+          for(uint32_t x = std::min(x0, x1); x <= std::max(x0, x1); ++x) { setCell(ZOOM, x, y, MIXED); }
+        }
+      }
+    }
+    ++npolys;
+  }
+
+  // flood fill each region of unmarked tiles w/ coverage of its first tile
+  size_t nregions = 0;
+  std::vector<uint32_t> stack;
+  for(uint32_t y0 = 0; y0 < COVER_SIZE; ++y0) {
+    for(uint32_t x0 = 0; x0 < COVER_SIZE; ++x0) {
+      if(getCell(ZOOM, x0, y0) != UNKNOWN) { continue; }
+      LngLat center = MapProjection::projectedMetersToLngLat(MapProjection::tileCenter(TileID(x0, y0, ZOOM)));
+      Features f = ocean.containingLonLat(center.longitude, center.latitude);
+      Cover c = f.begin() != f.end() ? OCEAN : LAND;
+      setCell(ZOOM, x0, y0, c);
+      stack.push_back(y0*COVER_SIZE + x0);
+      while(!stack.empty()) {
+        uint32_t x = stack.back() % COVER_SIZE, y = stack.back() / COVER_SIZE;
+        stack.pop_back();
+        auto visit = [&](uint32_t nx, uint32_t ny){
+          if(getCell(ZOOM, nx, ny) != UNKNOWN) { return; }
+          setCell(ZOOM, nx, ny, c);
+          stack.push_back(ny*COVER_SIZE + nx);
+        };
+        if(x > 0) { visit(x - 1, y); }
+        if(x + 1 < COVER_SIZE) { visit(x + 1, y); }
+        if(y > 0) { visit(x, y - 1); }
+        if(y + 1 < COVER_SIZE) { visit(x, y + 1); }
+      }
+      ++nregions;
+    }
+  }
+  buildPyramid();
+  double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  LOG("Ocean coverage built from %d ocean polygons in %.1f s: %d regions; z%d tiles %d ocean, %d land, %d mixed",
+      int(npolys), dt, int(nregions), ZOOM, int(m_counts[OCEAN]), int(m_counts[LAND]), int(m_counts[MIXED]));
+}
+
+// lower zoom tile is ocean or land only if all four children are
+void OceanCoverage::buildPyramid()
+{
+  std::fill_n(m_counts, UNKNOWN, 0);
+  for(uint32_t y = 0; y < COVER_SIZE; ++y) {
+    for(uint32_t x = 0; x < COVER_SIZE; ++x) {
+      Cover c = getCell(ZOOM, x, y);
+      if(c != UNKNOWN) { ++m_counts[c]; }
+    }
+  }
+  for(int z = ZOOM - 1; z >= 0; --z) {
+    m_levels[z].assign(((size_t(1) << 2*z) + 3)/4, 0);
+    for(uint32_t y = 0; y < (1u << z); ++y) {
+      for(uint32_t x = 0; x < (1u << z); ++x) {
+        Cover c = getCell(z+1, 2*x, 2*y);
+        bool same = c == getCell(z+1, 2*x+1, 2*y) && c == getCell(z+1, 2*x, 2*y+1) && c == getCell(z+1, 2*x+1, 2*y+1);
+        setCell(z, x, y, same ? c : MIXED);
+      }
+    }
+  }
+}
+
+OceanCoverage::Cover OceanCoverage::get(TileID id) const
+{
+  if(id.z > ZOOM) { id = id.withMaxSourceZoom(ZOOM); }
+  return getCell(id.z, id.x, id.y);
+}
+
+TileBlob OceanCoverage::emptyTile(const Features& world, TileID id, const std::function<std::string()>& buildFn)
+{
+  // below z8, ocean comes from the (split) ocean polygons intersecting tile, so isn't the same for every tile
+  if(id.z < 8 || id.z >= BuildStats::NUM_ZOOMS) { return {}; }
+  Cover c = get(id);
+  if(c != OCEAN && c != LAND) { return {}; }
+  Features feats = world(TileBuilder::tileBox(id));
+  if(feats.begin() != feats.end()) { return {}; }
+  if(c == LAND) { return m_landTile; }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  TileBlob& blob = m_oceanTiles[id.z];
+  if(!blob) { blob = std::make_shared<const std::string>(buildFn()); }
+  return blob;
+}
+
+bool OceanCoverage::load(const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  if(!f) { return false; }
+  char magic[4];
+  uint32_t zoom = 0;
+  m_levels[ZOOM].resize((size_t(1) << 2*ZOOM)/4);
+  bool ok = fread(magic, 4, 1, f) == 1 && memcmp(magic, COVER_MAGIC, 4) == 0
+      && fread(&zoom, sizeof(zoom), 1, f) == 1 && zoom == ZOOM
+      && fread(m_levels[ZOOM].data(), m_levels[ZOOM].size(), 1, f) == 1;
+  fclose(f);
+  if(!ok) {
+    LOG("Invalid ocean coverage file %s", path);
+    return false;
+  }
+  buildPyramid();
+  LOG("Loaded ocean coverage from %s: z%d tiles %d ocean, %d land, %d mixed", path, ZOOM,
+      int(m_counts[OCEAN]), int(m_counts[LAND]), int(m_counts[MIXED]));
+  return true;
+}
+
+bool OceanCoverage::save(const char* path) const
+{
+  FILE* f = fopen(path, "wb");
+  if(!f) { return false; }
+  uint32_t zoom = ZOOM;
+  bool ok = fwrite(COVER_MAGIC, 4, 1, f) == 1 && fwrite(&zoom, sizeof(zoom), 1, f) == 1
+      && fwrite(m_levels[ZOOM].data(), m_levels[ZOOM].size(), 1, f) == 1;
+  return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include "tilebuilder.h"
+#include "tilecache.h"
+
+// ocean/land coverage of every tile at z <= ZOOM, so tiles w/o coastline can be classified w/o querying ocean
+//  GOL, and empty ocean and land tiles can be served w/o a build (or a row in mbtiles)
+// - z12 tiles crossed by an edge of an ocean polygon are mixed; every other connected region of z12 tiles is
+//  classified as ocean or land by a single ocean GOL query, then lower zooms are ocean or land only if all four
+//  children are the same
+// - 2 bits per tile: 4 MB for z12 plus 1.3 MB for lower zooms; only z12 is saved, since the rest is cheap to
+//  rebuild; saved file must be deleted if GOL is updated
+class OceanCoverage
+{
+public:
+  enum Cover : uint8_t { MIXED = 0, OCEAN = 1, LAND = 2, UNKNOWN = 3 };
+  static constexpr int ZOOM = 12;
+
+  void build(const Features& ocean);
+  bool load(const char* path);
+  bool save(const char* path) const;
+  Cover get(TileID id) const;  // for z > ZOOM, coverage of ancestor at ZOOM
+  // for tile w/ no world features which is all land (empty tile) or all ocean at z >= 8 (identical for every
+  //  tile at zoom, so built once by buildFn and shared), otherwise null
+  TileBlob emptyTile(const Features& world, TileID id, const std::function<std::string()>& buildFn);
+
+  size_t count(Cover c) const { return c < UNKNOWN ? m_counts[c] : 0; }  // z12 tiles
+
+private:
+  std::vector<uint8_t> m_levels[ZOOM + 1];  // 4 tiles per byte, row major
+  size_t m_counts[UNKNOWN] = {};
+  std::mutex m_mutex;
+  TileBlob m_oceanTiles[BuildStats::NUM_ZOOMS];
+  TileBlob m_landTile = std::make_shared<const std::string>();
+
+  Cover getCell(int z, uint32_t x, uint32_t y) const {
+    size_t idx = (size_t(y) << z) + x;
+    return Cover((m_levels[z][idx >> 2] >> 2*(idx & 3)) & 3);
+  }
+  void setCell(int z, uint32_t x, uint32_t y, Cover c) {
+    size_t idx = (size_t(y) << z) + x;
+    uint8_t& b = m_levels[z][idx >> 2];
+    b = (b & ~(3 << 2*(idx & 3))) | (c << 2*(idx & 3));
+  }
+  void buildPyramid();
+};
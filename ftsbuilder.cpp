@@ -1,6 +1,7 @@
 #include <geodesk/geodesk.h>
 #include "tilebuilder.h"
 #include "ulib.h"
+#include "searchcache.h"
 
 #define SQLITEPP_LOGE LOG
 #define SQLITEPP_LOGW LOG
@@ -14,12 +15,21 @@
 
 // search index query
 
-static const char* searchNoDistSQL = "SELECT pois.rowid, lng, lat, bm25_once(pois_fts, 1.0, 1.0, 0.25, 0.5) AS score, pois.tags, props FROM pois_fts JOIN pois ON"
-    " pois.ROWID = pois_fts.ROWID WHERE pois_fts MATCH ? ORDER BY osmSearchRank(score, pois.tags) LIMIT ? OFFSET ?;";
-static const char* searchDistSQL = "SELECT pois.rowid, lng, lat, bm25_once(pois_fts, 1.0, 1.0, 0.25, 0.5) AS score, pois.tags, props FROM pois_fts JOIN pois ON"
-    " pois.ROWID = pois_fts.ROWID WHERE pois_fts MATCH ? ORDER BY osmSearchRank(score, pois.tags, lng, lat, ?, ?, ?) LIMIT ? OFFSET ?;";
-static const char* searchOnlyDistSQL = "SELECT pois.rowid, lng, lat, -1.0, pois.tags, props FROM pois_fts JOIN pois ON"
-    " pois.ROWID = pois_fts.ROWID WHERE pois_fts MATCH ? ORDER BY osmSearchRank(-1.0, '', lng, lat, ?, ?, ?) LIMIT ? OFFSET ?;";
+// each search query is written for one shard, w/ $S. as schema prefix of tables (empty for main DB), so that the
+//  same query can run on every shard of a sharded DB; result columns are rowid, lng, lat, score, tags, props and
+//  rank is the ORDER BY expression on these columns
+// - parameters are numbered, so repeated parameters bind to the same value in every shard query
+struct SearchSQL { const char* query; const char* rank; const char* limit; const char* offset; };
+
+static const SearchSQL searchNoDistSQL = {"SELECT pois.rowid, lng, lat, bm25_once(pois_fts, 1.0, 1.0, 0.25, 0.5) AS score,"
+    " pois.tags, props FROM $S.pois_fts JOIN $S.pois ON pois.ROWID = pois_fts.ROWID WHERE pois_fts MATCH ?1",
+    "osmSearchRank(score, tags)", "?2", "?3"};
+static const SearchSQL searchDistSQL = {"SELECT pois.rowid, lng, lat, bm25_once(pois_fts, 1.0, 1.0, 0.25, 0.5) AS score,"
+    " pois.tags, props FROM $S.pois_fts JOIN $S.pois ON pois.ROWID = pois_fts.ROWID WHERE pois_fts MATCH ?1",
+    "osmSearchRank(score, tags, lng, lat, ?2, ?3, ?4)", "?5", "?6"};
+static const SearchSQL searchOnlyDistSQL = {"SELECT pois.rowid, lng, lat, -1.0 AS score, pois.tags, props"
+    " FROM $S.pois_fts JOIN $S.pois ON pois.ROWID = pois_fts.ROWID WHERE pois_fts MATCH ?1",
+    "osmSearchRank(-1.0, '', lng, lat, ?2, ?3, ?4)", "?5", "?6"};
 
 // r-tree index isn't actually used here, so better to just use p.lng, p.lat
 //static const char* searchBoundedSQL = R"#(SELECT p.rowid, p.lng, p.lat, -1.0, p.tags, p.props
@@ -37,13 +47,92 @@ static const char* searchOnlyDistSQL = "SELECT pois.rowid, lng, lat, -1.0, pois.
 // w/ rank: (SELECT rowid, bm25_once(pois_fts, 1.0, 1.0, 0.25, 0.5) AS score FROM pois_fts WHERE pois_fts MATCH ?) f
 // note that ... WHERE p.rowid IN ... is much faster than using f.rowid (uses FTS index differently for some reason)
 
-static const char* searchBoundedSQL = R"#(SELECT p.rowid, p.lng, p.lat, -1.0, p.tags, p.props
-  FROM pois p JOIN pois_fts f ON f.rowid = p.rowid
-  WHERE pois_fts MATCH ? AND p.lng >= ? AND p.lng <= ? AND p.lat >= ? AND p.lat <= ?
-  ORDER BY osmSearchRank(-1.0, '', p.lng, p.lat, ?, ?, ?) LIMIT ? OFFSET ?;)#";
+static const SearchSQL searchBoundedSQL = {R"#(SELECT p.rowid, p.lng, p.lat, -1.0 AS score, p.tags, p.props
+  FROM $S.pois p JOIN $S.pois_fts f ON f.rowid = p.rowid
+  WHERE pois_fts MATCH ?1 AND p.lng >= ?2 AND p.lng <= ?3 AND p.lat >= ?4 AND p.lat <= ?5)#",
+    "osmSearchRank(-1.0, '', lng, lat, ?6, ?7, ?8)", "?9", "?10"};
 
-static const char* countMatchesSQL = "SELECT count(1) FROM pois_fts WHERE pois_fts MATCH ?;";
+static const char* countMatchesSQL = "SELECT count(1) FROM $S.pois_fts WHERE pois_fts MATCH ?1";
 
+// for bm25 stats over all shards: rows and (w/ MATCH) rows matching each phrase of query, added by fts_stats()
+static const char* shardRowsSQL = "SELECT fts_stats(pois_fts) FROM $S.pois_fts LIMIT 1;";
+static const char* shardHitsSQL = "SELECT fts_stats(pois_fts) FROM $S.pois_fts WHERE pois_fts MATCH ?1 LIMIT 1;";
+
+// query for shard of search DB
+static std::string shardSQL(const char* sql, int shard)
+{
+  std::string dst(sql), schema = shard > 0 ? fstring("s%d.", shard) : std::string();
+  for(size_t pos = 0; (pos = dst.find("$S.", pos)) != std::string::npos; pos += schema.size())
+    dst.replace(pos, 3, schema);
+  return dst;
+}
+
+// for sharded search DB, query is run on each shard (main, s1, s2, ...) and overall LIMIT/OFFSET is taken from
+//  union of each shard's top LIMIT + OFFSET rows; rank is added as extra result column
+static std::string searchSQL(const SearchSQL& sql, int numShards)
+{
+  if(numShards < 2) {
+    return fstring("SELECT * FROM (%s) ORDER BY %s LIMIT %s OFFSET %s;",
+        shardSQL(sql.query, 0).c_str(), sql.rank, sql.limit, sql.offset);
+  }
+  std::string dst;
+  for(int shard = 0; shard < numShards; ++shard) {
+    dst += fstring("%sSELECT * FROM (SELECT *, %s AS shard_rank FROM (%s) ORDER BY shard_rank LIMIT %s + %s)",
+        shard > 0 ? " UNION ALL " : "", sql.rank, shardSQL(sql.query, shard).c_str(), sql.limit, sql.offset);
+  }
+  return dst + fstring(" ORDER BY shard_rank LIMIT %s OFFSET %s;", sql.limit, sql.offset);
+}
+
+static std::string countSQL(int numShards)
+{
+  std::string dst = "SELECT 0";
+  for(int shard = 0; shard < numShards; ++shard) { dst += " + (" + shardSQL(countMatchesSQL, shard) + ")"; }
+  return dst + ";";
+}
+
+// FTS5 query matching rows that contain any phrase of query, w/ the same phrases and column filters in the same
+//  order (so phrase i of query is phrase i of result): AND, NOT, and implicit AND are replaced by OR
+// - returns empty string for query w/ NEAR group (never generated by ftsQuery)
+static std::string anyPhraseQuery(const std::string& query)
+{
+  auto isBare = [](char c){ return std::isalnum((unsigned char)c) || c == '_' || c == 0x1A || (c & 0x80); };
+  std::string dst;
+  bool afterOperand = false;  // last token ended a phrase or parenthesized expression
+  bool inColumns = false;  // in {...} column filter
+  for(size_t ii = 0; ii < query.size();) {
+    size_t start = ii;
+    char c = query[ii];
+    if(std::isspace((unsigned char)c)) { dst.push_back(c);  ++ii;  continue; }
+    if(c == '"') {
+      // "" is an escaped quote
+      for(++ii; ii < query.size(); ++ii) {
+        if(query[ii] != '"') { continue; }
+        if(ii + 1 < query.size() && query[ii+1] == '"') { ++ii; }
+        else { ++ii;  break; }
+      }
+    }
+    else if(isBare(c)) { while(ii < query.size() && isBare(query[ii])) { ++ii; } }
+    else { ++ii; }
+    std::string tok = query.substr(start, ii - start);
+    if(tok == "NEAR") { return ""; }
+    if(inColumns) { inColumns = tok != "}";  dst += tok;  continue; }
+    if(tok == "AND" || tok == "OR" || tok == "NOT") { dst += "OR";  afterOperand = false;  continue; }
+    bool isPhrase = c == '"' || isBare(c);
+    if(afterOperand && (isPhrase || tok == "(" || tok == "{" || tok == "-" || tok == "^")) { dst += "OR "; }
+    dst += tok;
+    inColumns = tok == "{";
+    afterOperand = isPhrase || tok == ")" || tok == "*";
+  }
+  return dst;
+}
+
+// totals over all shards of sharded search DB, so that bm25_once() uses the same IDF in every shard (the same as
+//  for an unsharded DB) and scores from different shards are comparable
+struct Bm25Stats {
+  int64_t nRow = 0;  // rows in all shards
+  std::vector<int64_t> nHit;  // rows in all shards matching each phrase of current query
+  bool valid = false;  // set while running query w/ these stats
+};
 
 class SearchDB : public SQLiteDB
 {
@@ -54,8 +143,29 @@ public:
   SQLiteStmt searchBounded = {NULL};
   SQLiteStmt countMatches = {NULL};
   SQLiteStmt insertPOI = {NULL};
+  std::vector<SQLiteStmt> shardHits;  // empty if not sharded
+  Bm25Stats bm25Stats;
+  int64_t totalRows = 0;
+
+  bool loadBm25Stats(const std::string& query);
 };
 
+// get IDF inputs for query from all shards
+bool SearchDB::loadBm25Stats(const std::string& query)
+{
+  std::string anyQuery = anyPhraseQuery(query);
+  if(anyQuery.empty()) { return false; }
+  bm25Stats.nRow = 0;
+  bm25Stats.nHit.clear();
+  // a shard w/o any rows matching anyQuery has no hits for any phrase (and fts_stats() isn't called)
+  for(SQLiteStmt& stmt : shardHits) {
+    if(!stmt.bind(anyQuery).exec([](sqlite3_stmt*){})) { return false; }
+  }
+  bm25Stats.nRow = totalRows;
+  bm25Stats.valid = true;
+  return true;
+}
+
 thread_local SearchDB searchDB;
 
 static const char* POI_SCHEMA = R"#(PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;
@@ -107,34 +217,52 @@ static bool isHeavyTile(const Features& worldGOL, TileID id, int nfeats = 16384)
   return false;
 }
 
-int buildSearchIndex(const Features& worldGOL, TileID toptile, const std::string& searchDBPath)
+// path of shard n of search DB; shard 0 is the main DB, which lists the others in its shards table
+static std::string shardPath(const std::string& searchDBPath, int shard)
 {
-  int numThreads = std::max(2U, std::thread::hardware_concurrency()) - 1;
-  ThreadPool indexWorkers(numThreads);
-  ThreadPool dbWriter(1);  // ThreadPool(1) is like AsyncWorker
+  return shard > 0 ? searchDBPath + "." + std::to_string(shard) : searchDBPath;
+}
 
-  auto dbfut = dbWriter.enqueue([&](){
-    if(searchDB.open(searchDBPath, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) != SQLITE_OK) {
-      LOG("Error opening search DB %s", searchDBPath.c_str());
-      return false;
-    }
-    //if(!searchDB.exec(POI_SCHEMA)) { return false; }
-    if(!searchDB.exec(POI_SCHEMA)) {
-      LOG("Error creating FTS tables: %s", searchDB.errMsg());
-      return false;
-    }
-    char const* insertPOISQL = "INSERT INTO pois (name,name_en,admin,tags,props,lng,lat) VALUES (?,?,?,?,?,?,?);";
-    searchDB.insertPOI = searchDB.stmt(insertPOISQL);
-    return true;
-  });
-  if(!dbfut.get()) { return -1; }
+// each shard (up to MAX_SHARDS, the sqlite limit on attached DBs) is a complete search DB for a set of z4
+//  tiles, w/ its own writer thread, so rows, FTS index, and rtree are all built in parallel; ftsQuery() attaches
+//  the shards listed in main DB and runs each query on all of them
+static constexpr int MAX_SHARDS = 10;
 
-  size_t nfeats = 0;
+int buildSearchIndex(const Features& worldGOL, TileID toptile, const std::string& searchDBPath, int numShards)
+{
+  int numThreads = std::max(2U, std::thread::hardware_concurrency()) - 1;
+  numShards = std::max(1, std::min(numShards, MAX_SHARDS));
+  WorkStealingPool indexWorkers(numThreads);
+  // ThreadPool(1) is like AsyncWorker; searchDB is thread_local, so each writer has its own DB connection
+  std::vector< std::unique_ptr<ThreadPool> > dbWriters;
+  std::vector< std::future<bool> > dbfuts;
+  for(int shard = 0; shard < numShards; ++shard) {
+    dbWriters.push_back(std::make_unique<ThreadPool>(1));
+    dbfuts.push_back(dbWriters.back()->enqueue([&, path = shardPath(searchDBPath, shard)](){
+      if(searchDB.open(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) != SQLITE_OK) {
+        LOG("Error opening search DB %s", path.c_str());
+        return false;
+      }
+      //if(!searchDB.exec(POI_SCHEMA)) { return false; }
+      if(!searchDB.exec(POI_SCHEMA)) {
+        LOG("Error creating FTS tables in %s: %s", path.c_str(), searchDB.errMsg());
+        return false;
+      }
+      char const* insertPOISQL = "INSERT INTO pois (name,name_en,admin,tags,props,lng,lat) VALUES (?,?,?,?,?,?,?);";
+      searchDB.insertPOI = searchDB.stmt(insertPOISQL);
+      return true;
+    }));
+  }
+  for(auto& fut : dbfuts) {
+    if(!fut.get()) { return -1; }
+  }
+
+  std::atomic_size_t nfeats = 0;
   auto t0 = std::chrono::steady_clock::now();
   std::function<void(TileID)> buildFn = [&](TileID id){
     if(id.z < 4 || (id.z < 10 && isHeavyTile(worldGOL, id))) {
       for(int ii = 0; ii < 4; ++ii)
-        indexWorkers.enqueue(buildFn, id.getChild(ii, 10));
+        indexWorkers.post([&, child = id.getChild(ii, 10)](){ buildFn(child); });
       return;
     }
     int idmask = (1 << (id.z - 4)) - 1;  // print for upper-leftmost tile inside each z4 tile
@@ -144,7 +272,10 @@ int buildSearchIndex(const Features& worldGOL, TileID toptile, const std::string
     std::vector<PoiRow> rows = indexTile(worldGOL, id);
     if(!rows.empty()) {
       nfeats += rows.size();
-      dbWriter.enqueue([&, rows = std::move(rows), id](){
+      // z4 tiles are dealt to shards in row major order, so each shard gets a mix of dense and sparse regions
+      TileID id4 = id.withMaxSourceZoom(4);
+      int shard = (id4.y*16 + id4.x) % numShards;
+      dbWriters[shard]->enqueue([&, rows = std::move(rows), id](){
         searchDB.exec("BEGIN;");
         for(auto& r : rows) {
           if(!searchDB.insertPOI.bind(r.name, r.name_en, r.admin, r.tags, r.props, r.lng, r.lat).exec())
@@ -156,18 +287,26 @@ int buildSearchIndex(const Features& worldGOL, TileID toptile, const std::string
 
   };
   //onSigInt = [&](){ buildWorkers.requestStop(true); };
-  indexWorkers.enqueue(buildFn, toptile);
+  indexWorkers.post([&](){ buildFn(toptile); });
   indexWorkers.waitForIdle();
-  LOGT(t0, "%zu features processed", nfeats);
-  dbWriter.enqueue([&](){
-    LOGT(t0, "Building FTS index...");
-    searchDB.exec("INSERT INTO pois_fts(pois_fts) VALUES('rebuild');");
-    LOGT(t0, "Building rtree index...");
-    searchDB.exec("INSERT INTO rtree_index SELECT rowid, lng, lng, lat, lat FROM pois;");
-  });
-  dbWriter.waitForIdle();
+  LOGT(t0, "%zu features processed", nfeats.load());
+  for(int shard = 0; shard < numShards; ++shard) {
+    dbWriters[shard]->enqueue([&, shard](){
+      LOGT(t0, "Building FTS index for shard %d...", shard);
+      searchDB.exec("INSERT INTO pois_fts(pois_fts) VALUES('rebuild');");
+      LOGT(t0, "Building rtree index for shard %d...", shard);
+      searchDB.exec("INSERT INTO rtree_index SELECT rowid, lng, lng, lat, lat FROM pois;");
+      if(shard > 0 || numShards < 2) { return; }
+      // shard paths are saved relative to main DB
+      std::string dbname = searchDBPath.substr(searchDBPath.find_last_of('/') + 1);
+      searchDB.exec("CREATE TABLE shards(path TEXT);");
+      SQLiteStmt insertShard = searchDB.stmt("INSERT INTO shards (path) VALUES (?);");
+      for(int ii = 1; ii < numShards; ++ii) { insertShard.bind(shardPath(dbname, ii)).exec(); }
+    });
+  }
+  for(auto& writer : dbWriters) { writer->waitForIdle(); }
   //LOGT(t0, "Finished: %d / %d / %d (total/tests/hits)", numMPolyTests.load(), numPinPTests.load(), numPinPHits.load());
-  LOGT(t0, "Finished");
+  LOGT(t0, "Finished (%d shards)", numShards);
   return 0;
 }
 
@@ -185,6 +324,72 @@ int buildSearchIndex(const Features& worldGOL, TileID toptile, const std::string
   return in;
 }
 
+// point in polygon index for admin areas: edges are bucketed by horizontal band, so a test only visits edges
+//  overlapping the point's band instead of every edge of every ring; result is the same as pointInPolygon()
+//  on each polygon of mpoly (edges within a band are kept in polygon order so parity can be tracked per polygon)
+class EdgeBands
+{
+public:
+  EdgeBands(const vt_multi_polygon& mpoly, vt_point min, vt_point max);
+  bool contains(vt_point p) const;
+  size_t numEdges() const { return m_edges.size(); }
+
+private:
+  struct Edge { vt_point a, b; uint32_t poly; };
+  std::vector<Edge> m_edges;  // edges of band i are m_edges[m_bandStart[i]] to m_edges[m_bandStart[i+1]-1]
+  std::vector<uint32_t> m_bandStart;
+  float m_y0, m_scale;
+  int m_numBands;
+
+  int band(float y) const { return std::max(0, std::min(int((y - m_y0)*m_scale), m_numBands - 1)); }
+};
+
+EdgeBands::EdgeBands(const vt_multi_polygon& mpoly, vt_point min, vt_point max) : m_y0(min.y)
+{
+  size_t n = 0;
+  for(auto& poly : mpoly) {
+    for(auto& ring : poly) { n += ring.size(); }
+  }
+  m_numBands = std::max(1, std::min(int(n/4), 1024));  // ~4 edges per band if edges are short
+  m_scale = max.y > min.y ? m_numBands/(max.y - min.y) : 0;
+
+  // count edges per band, then fill (counting sort)
+  std::vector<uint32_t> counts(m_numBands + 1, 0);
+  auto forEachEdge = [&](auto&& fn){
+    for(uint32_t pi = 0; pi < mpoly.size(); ++pi) {
+      for(auto& ring : mpoly[pi]) {
+        for(size_t i = 0, j = ring.size()-1; i < ring.size(); j = i++) {
+          const vt_point& a = ring[i];
+          const vt_point& b = ring[j];
+          for(int k = band(std::min(a.y, b.y)); k <= band(std::max(a.y, b.y)); ++k) { fn(k, Edge{a, b, pi}); }
+        }
+      }
+    }
+  };
+  forEachEdge([&](int k, const Edge&){ ++counts[k+1]; });
+  for(int k = 0; k < m_numBands; ++k) { counts[k+1] += counts[k]; }
+  m_bandStart = counts;
+  m_edges.resize(counts.back());
+  forEachEdge([&](int k, const Edge& e){ m_edges[counts[k]++] = e; });
+}
+
+bool EdgeBands::contains(vt_point p) const
+{
+  int k = band(p.y);
+  bool in = false;
+  uint32_t poly = UINT32_MAX;
+  for(uint32_t ii = m_bandStart[k]; ii < m_bandStart[k+1]; ++ii) {
+    const Edge& e = m_edges[ii];
+    if(e.poly != poly) {
+      if(in) { return true; }
+      poly = e.poly;
+    }
+    if(((e.a.y > p.y) != (e.b.y > p.y)) && (p.x < (e.b.x - e.a.x) * (p.y - e.a.y) / (e.b.y - e.a.y) + e.a.x))
+      in = !in;
+  }
+  return in;
+}
+
 static void addJson(std::string& json, const std::string& key, const std::string& val)
 {
   if(val.empty()) { return; }
@@ -197,7 +402,7 @@ static void addJson(std::string& json, const std::string& key, const std::string
   json += '"';
 }
 
-#define readTag(feat, s) feat[ ( [](){ static geodesk::Key cs = worldFeats->key(s); return cs; }() ) ]
+#define readTag(feat, s) feat[ ( [](){ static GolKey key(s); return key.get(); }() ) ]
 
 std::vector<PoiRow> FTSBuilder::index(const Features& world)  //, const Features& ocean, bool compress)
 {
@@ -208,7 +413,7 @@ std::vector<PoiRow> FTSBuilder::index(const Features& world)  //, const Features
   static std::vector<geodesk::Key> poiTags = [&](){
     std::vector<geodesk::Key> keys;
     keys.reserve(poiTagStrs.size());
-    for(auto& tag : poiTagStrs) { keys.push_back(worldFeats->key(tag)); }
+    for(auto& tag : poiTagStrs) { keys.push_back(m_gol.world.key(tag)); }
     return keys;
   }();
   static std::unordered_set<std::string> anon_amenities = {"drinking_water", "toilets", "atm",
@@ -231,7 +436,7 @@ std::vector<PoiRow> FTSBuilder::index(const Features& world)  //, const Features
   Features pois = tileFeats("na[name]");  //"n[place=*]"
   if(pois.begin() == pois.end()) { return {}; }  // skip admin area processing if nothing to index
 
-  struct AdminMPoly { int level; int64_t id; std::string name, name_en; vt_point min, max; vt_multi_polygon mpoly; };
+  struct AdminMPoly { int level; int64_t id; std::string name, name_en; vt_point min, max; EdgeBands edges; };
   std::vector<AdminMPoly> adminMPolys;
 
   // admin_level = 3,5,7 are mostly undesired in US, Europe, but China cities are 5, Japan cities 7
@@ -257,7 +462,8 @@ std::vector<PoiRow> FTSBuilder::index(const Features& world)  //, const Features
       if(name.empty()) { continue; }
       std::string name_en = readTag(f, "name:en");
       if(name_en == name) { name_en.clear(); }
-      adminMPolys.push_back({level, f.id(), name, name_en, m_polyMin, m_polyMax, m_featMPoly});
+      adminMPolys.push_back({level, f.id(), name, name_en, m_polyMin, m_polyMax,
+          EdgeBands(m_featMPoly, m_polyMin, m_polyMax)});
     }
   }
 
@@ -313,16 +519,13 @@ std::vector<PoiRow> FTSBuilder::index(const Features& world)  //, const Features
       if(pt.x < mp.min.x || pt.y < mp.min.y || pt.x > mp.max.x || pt.y > mp.max.y) { continue; }
       if(flevel <= mp.level) { continue; }  // only include lower admin levels
       //++numPinPTests;
-      for(auto& poly : mp.mpoly) {
-        if(pointInPolygon(poly, pt)) {
-          //++numPinPHits;
-          if(!adminfts.empty()) { adminfts.push_back(' '); }
-          if(!mp.name_en.empty()) { adminfts.append(mp.name_en).push_back(' '); }
-          adminfts.append(mp.name);
-          if(!admin.empty()) { admin.append(", "); }
-          admin.append(!mp.name_en.empty() ? mp.name_en : mp.name);
-          break;
-        }
+      if(mp.edges.contains(pt)) {
+        //++numPinPHits;
+        if(!adminfts.empty()) { adminfts.push_back(' '); }
+        if(!mp.name_en.empty()) { adminfts.append(mp.name_en).push_back(' '); }
+        adminfts.append(mp.name);
+        if(!admin.empty()) { admin.append(", "); }
+        admin.append(!mp.name_en.empty() ? mp.name_en : mp.name);
       }
     }
 
@@ -375,6 +578,25 @@ static int fts5CountCb(const Fts5ExtensionApi *pApi, Fts5Context *pFts, void *pU
   return SQLITE_OK;
 }
 
+// fts_stats(): add row count and rows matching each phrase of query for this shard to Bm25Stats
+static void fts5StatsFunction(const Fts5ExtensionApi *pApi, Fts5Context *pFts, sqlite3_context *pCtx,
+    int nVal, sqlite3_value **apVal)
+{
+  Bm25Stats* stats = (Bm25Stats*)pApi->xUserData(pFts);
+  sqlite3_int64 nRow = 0;
+  int rc = pApi->xRowCount(pFts, &nRow);
+  int nPhrase = pApi->xPhraseCount(pFts);
+  if(int(stats->nHit.size()) < nPhrase) { stats->nHit.resize(nPhrase, 0); }
+  for(int i = 0; rc == SQLITE_OK && i < nPhrase; i++) {
+    sqlite3_int64 nHit = 0;
+    rc = pApi->xQueryPhrase(pFts, i, (void*)&nHit, fts5CountCb);
+    stats->nHit[i] += nHit;
+  }
+  stats->nRow += nRow;
+  if(rc == SQLITE_OK) { sqlite3_result_null(pCtx); }
+  else { sqlite3_result_error_code(pCtx, rc); }
+}
+
 // Set *ppData to point to the Fts5Bm25Data object for the current query.
 // If the object has not already been allocated, allocate and populate it
 // now.
@@ -404,8 +626,15 @@ static int fts5Bm25GetData(const Fts5ExtensionApi *pApi, Fts5Context *pFts, Fts5
       p->aFreq = &p->aIDF[nPhrase];
     }
 
+    // for sharded DB, w/ totals over all shards (if loaded for query)
+    Bm25Stats* stats = (Bm25Stats*)pApi->xUserData(pFts);
+    if(stats && !stats->valid) { stats = nullptr; }
+
     /* Calculate the average document length for this FTS5 table */
-    if( rc==SQLITE_OK ) rc = pApi->xRowCount(pFts, &nRow);
+    if( rc==SQLITE_OK ) {
+      if(stats) { nRow = stats->nRow; }
+      else { rc = pApi->xRowCount(pFts, &nRow); }
+    }
     assert( rc!=SQLITE_OK || nRow>0 );
     //~if( rc==SQLITE_OK ) rc = pApi->xColumnTotalSize(pFts, 0, &nToken);  // total name tokens
     //~if( rc==SQLITE_OK ) p->avgdl = (double)nToken  / (double)nRow;
@@ -413,7 +642,8 @@ static int fts5Bm25GetData(const Fts5ExtensionApi *pApi, Fts5Context *pFts, Fts5
     /* Calculate an IDF for each phrase in the query */
     for(i=0; rc==SQLITE_OK && i<nPhrase; i++){
       sqlite3_int64 nHit = 0;
-      rc = pApi->xQueryPhrase(pFts, i, (void*)&nHit, fts5CountCb);
+      if(stats) { nHit = i < int(stats->nHit.size()) ? stats->nHit[i] : 0; }
+      else { rc = pApi->xQueryPhrase(pFts, i, (void*)&nHit, fts5CountCb); }
       if( rc==SQLITE_OK ){
         double idf = log( (nRow - nHit + 0.5) / (nHit + 0.5) );
         if( idf<=0.0 ) idf = 1e-6;
@@ -631,7 +861,10 @@ static const std::vector<std::string> extrawords = {
 };
 
 // note that this is called on a cpp-httplib thread (and that searchDB is thread local!)
-std::string ftsQuery(const std::multimap<std::string, std::string>& params, const std::string& searchDBPath)
+// if cache is provided, results are cached by normalized query (i.e., FTS query string) and bounds, quantized
+//  so nearby map views share entries; cacheHit is set if result came from cache
+std::string ftsQuery(const std::multimap<std::string, std::string>& params, const std::string& searchDBPath,
+    SearchCache* cache, bool* cacheHit)
 {
   //static int maxWorldHits = [](){ const char* s = getenv("ASCEND_MAX_WORLD_HITS"); return s ? atoi(s) : 0; }();
   if(!searchDB.db) {
@@ -645,15 +878,39 @@ std::string ftsQuery(const std::multimap<std::string, std::string>& params, cons
     }
     //SQLITE_EXTENSION_INIT2(pApi);
     fts5_api* api = mfts5_api_from_db(searchDB.db);
-    if(!api || api->xCreateFunction(api, "bm25_once", NULL, fts5Bm25Function, NULL) != SQLITE_OK) {
+    if(!api || api->xCreateFunction(api, "bm25_once", &searchDB.bm25Stats, fts5Bm25Function, NULL) != SQLITE_OK
+        || api->xCreateFunction(api, "fts_stats", &searchDB.bm25Stats, fts5StatsFunction, NULL) != SQLITE_OK) {
       LOG("error adding custom FTS5 ranking function for search DB");
       return {};
     }
-    searchDB.searchNoDist = searchDB.stmt(searchNoDistSQL);
-    searchDB.searchDist = searchDB.stmt(searchDistSQL);
-    searchDB.searchOnlyDist = searchDB.stmt(searchOnlyDistSQL);
-    searchDB.searchBounded = searchDB.stmt(searchBoundedSQL);
-    searchDB.countMatches = searchDB.stmt(countMatchesSQL);
+    // attach shards, if any
+    int numShards = 1;
+    std::string dbdir = searchDBPath.substr(0, searchDBPath.find_last_of('/') + 1);
+    int64_t hasShards = 0;
+    searchDB.stmt("SELECT count(1) FROM sqlite_master WHERE type = 'table' AND name = 'shards';").onerow(hasShards);
+    std::vector<std::string> shards;
+    if(hasShards)
+      searchDB.stmt("SELECT path FROM shards;").exec([&](const char* path){ shards.push_back(path); });
+    for(const std::string& shard : shards) {
+      std::string sql = fstring("ATTACH DATABASE '%s' AS s%d;", (dbdir + shard).c_str(), numShards);
+      if(!searchDB.exec(sql)) {
+        LOG("Error attaching search DB shard %s: %s", shard.c_str(), searchDB.errMsg());
+        return {};
+      }
+      ++numShards;
+    }
+    searchDB.searchNoDist = searchDB.stmt(searchSQL(searchNoDistSQL, numShards));
+    searchDB.searchDist = searchDB.stmt(searchSQL(searchDistSQL, numShards));
+    searchDB.searchOnlyDist = searchDB.stmt(searchSQL(searchOnlyDistSQL, numShards));
+    searchDB.searchBounded = searchDB.stmt(searchSQL(searchBoundedSQL, numShards));
+    searchDB.countMatches = searchDB.stmt(countSQL(numShards));
+    if(numShards > 1) {
+      for(int shard = 0; shard < numShards; ++shard) {
+        searchDB.stmt(shardSQL(shardRowsSQL, shard)).exec([](sqlite3_stmt*){});
+        searchDB.shardHits.push_back(searchDB.stmt(shardSQL(shardHitsSQL, shard)));
+      }
+      searchDB.totalRows = searchDB.bm25Stats.nRow;
+    }
     //LOG("Loaded FTS database %s", searchDBPath.c_str());
   }
 
@@ -680,6 +937,13 @@ std::string ftsQuery(const std::multimap<std::string, std::string>& params, cons
   if(parts.size() == 4) {
     lngLat00 = LngLat(atof(parts[0].c_str()), atof(parts[1].c_str()));
     lngLat11 = LngLat(atof(parts[2].c_str()), atof(parts[3].c_str()));
+    // snap bounds outward to power of 2 grid of ~1/64 of bounds size
+    double span = std::max(lngLat11.longitude - lngLat00.longitude, lngLat11.latitude - lngLat00.latitude);
+    if(cache && span > 0) {
+      double step = std::exp2(std::floor(std::log2(span/64)));
+      lngLat00 = LngLat(std::floor(lngLat00.longitude/step)*step, std::floor(lngLat00.latitude/step)*step);
+      lngLat11 = LngLat(std::ceil(lngLat11.longitude/step)*step, std::ceil(lngLat11.latitude/step)*step);
+    }
   }
 
   // cut and paste from transform_query.js
@@ -732,6 +996,33 @@ std::string ftsQuery(const std::multimap<std::string, std::string>& params, cons
   double radius = std::max(heightkm, widthkm)/2;
   if(radius > 5000) { radius = 0; }  // disable distance ranking at very low zoom
 
+  // autocomplete on a single word matches a subset of what any shorter prefix of the word matches, so if a
+  //  shorter prefix had no results (saved w/ emptyKey), neither does this one
+  std::string cacheKey, emptyKey;
+  if(cache && !debug) {
+    std::string boundsKey = fstring("%.9g,%.9g,%.9g,%.9g", lngLat00.longitude, lngLat00.latitude,
+        lngLat11.longitude, lngLat11.latitude);
+    cacheKey = fstring("%s|%d|%d|%s|%d|%d|", searchStr.c_str(), int(isCategorical), int(bounded), sortBy.c_str(),
+        offset, limit) + boundsKey;
+    if(SearchResult res = cache->get(cacheKey)) {
+      if(cacheHit) { *cacheHit = true; }
+      return *res;
+    }
+    const char* prefixFmt = "{name name_en} : \"";
+    if(searchStr.starts_with(prefixFmt) && searchStr.ends_with("\"*")) {
+      std::string word = searchStr.substr(strlen(prefixFmt), searchStr.size() - strlen(prefixFmt) - 2);
+      std::string emptyBase = std::string("empty|") + (bounded ? boundsKey : "") + "|";
+      emptyKey = emptyBase + word;
+      for(size_t len = word.size() - 1; word.find('"') == std::string::npos && len > 0 && len < word.size(); --len) {
+        if(SearchResult res = cache->get(emptyBase + word.substr(0, len), false)) {
+          ++cache->prefixHits;
+          if(cacheHit) { *cacheHit = true; }
+          return *res;
+        }
+      }
+    }
+  }
+
   int64_t nhits = 0;  //namehits = 0, taghits = 0;
   //searchDB.countMatches.bind("{name name_en tags} : " + searchStr).onerow(nhits);
   // if many hits, we could try to detect categorical search by taghits >> namehits
@@ -741,7 +1032,9 @@ std::string ftsQuery(const std::multimap<std::string, std::string>& params, cons
   bool ok = false;
   std::string json = R"({ "results": [ )";  //fstring(R"({"total": %d, "results": [ )", int(nhits));
   json.reserve(65536);
+  int nrows = 0;
   auto rowcb = [&](int rowid, double lng, double lat, double score, const char* tags, const char* props){
+    ++nrows;
     //if(debug) {
     //  double tagscore = applyTagScore(score, tags);
     //  double distscore = applyDistScore(tagscore, center, LngLat(lng, lat), radius);
@@ -768,9 +1061,15 @@ std::string ftsQuery(const std::multimap<std::string, std::string>& params, cons
         lngLat00.longitude, lngLat11.longitude, lngLat00.latitude, lngLat11.latitude,
         center.longitude, center.latitude, radius, limit, offset).exec(rowcb);
   }
+  else if(isCategorical || sortBy == "dist") {
+    ok = searchDB.searchOnlyDist.bind(searchStr, center.longitude, center.latitude, radius, limit, offset).exec(rowcb);
+  }
   else {
-    ok = (isCategorical || sortBy == "dist" ? searchDB.searchOnlyDist : searchDB.searchDist)
-        .bind(searchStr, center.longitude, center.latitude, radius, limit, offset).exec(rowcb);
+    // w/o totals over all shards, ranks from different shards wouldn't be comparable
+    if(!searchDB.shardHits.empty() && !searchDB.loadBm25Stats(searchStr))
+      LOG("Error getting search stats over all shards for %s", searchStr.c_str());
+    ok = searchDB.searchDist.bind(searchStr, center.longitude, center.latitude, radius, limit, offset).exec(rowcb);
+    searchDB.bm25Stats.valid = false;
   }
 
   if(!ok) { return {}; }
@@ -781,5 +1080,10 @@ std::string ftsQuery(const std::multimap<std::string, std::string>& params, cons
   }
   else
     json.append(" ] }");
+  if(!cacheKey.empty()) {
+    auto res = std::make_shared<const std::string>(json);
+    cache->put(cacheKey, res);
+    if(nrows == 0 && offset == 0 && !emptyKey.empty()) { cache->put(emptyKey, res); }
+  }
   return json;
 }
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include "clipper.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// batched geometry kernel: projects mercator coords (SoA, as decoded from GOL) to tile coords, computing
+//  bounds and, for rings, shoelace area and centroid sums in the same pass
+// - uses AVX2 if enabled (release build uses -march=native), otherwise scalar loop (auto-vectorized for
+//  other targets except for the area sums)
+// - area is sum of x[i]*y[i+1] - x[i+1]*y[i] (i.e., twice signed area) and centroid is sum of each area
+//  term times p[i] + p[i+1] (i.e., 6 * area * centroid)
+struct ProjectedBounds
+{
+  vt_point min = vt_point(REAL_MAX, REAL_MAX);
+  vt_point max = vt_point(-REAL_MAX, -REAL_MAX);
+  double area = 0;
+  linalg::vec<double,2> centroid = {0, 0};
+
+  // trivial reject and accept tests for clipping to unit tile
+  bool outside() const { return min.x > 1 || min.y > 1 || max.x < 0 || max.y < 0; }
+  bool inside() const { return min.x >= 0 && min.y >= 0 && max.x <= 1 && max.y <= 1; }
+};
+
+static_assert(sizeof(vt_point) == 2*sizeof(float), "vt_point must be packed x,y floats");
+
+#ifdef __AVX2__
+inline float hmin4(__m128 v)
+{
+  v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+  return _mm_cvtss_f32(_mm_min_ss(v, _mm_shuffle_ps(v, v, 1)));
+}
+
+inline float hmax4(__m128 v)
+{
+  v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+  return _mm_cvtss_f32(_mm_max_ss(v, _mm_shuffle_ps(v, v, 1)));
+}
+
+inline double hsum4(__m256d v)
+{
+  __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+#endif
+
+// out[i] = scale*((xs[i], ys[i]) - origin); out must have room for n points
+inline ProjectedBounds projectPoints(const int32_t* xs, const int32_t* ys, size_t n,
+    linalg::vec<double,2> origin, double scale, vt_point* out, bool withArea)
+{
+  ProjectedBounds b;
+  size_t ii = 0;
+#ifdef __AVX2__
+  if(n >= 8) {
+    const __m256d ox = _mm256_set1_pd(origin.x), oy = _mm256_set1_pd(origin.y), sc = _mm256_set1_pd(scale);
+    __m128 minx = _mm_set1_ps(REAL_MAX), miny = minx, maxx = _mm_set1_ps(-REAL_MAX), maxy = maxx;
+    __m256d area = _mm256_setzero_pd(), cx = area, cy = area;
+    // previous block, so last point of previous block can be paired w/ first point of current block; for the
+    //  first block, first point is paired with itself, giving zero area term
+    __m128 lastx = _mm_set1_ps(float(scale*(xs[0] - origin.x)));
+    __m128 lasty = _mm_set1_ps(float(scale*(ys[0] - origin.y)));
+    for(; ii + 4 <= n; ii += 4) {
+      __m256d dx = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(xs + ii)));
+      __m256d dy = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(ys + ii)));
+      __m128 px = _mm256_cvtpd_ps(_mm256_mul_pd(sc, _mm256_sub_pd(dx, ox)));
+      __m128 py = _mm256_cvtpd_ps(_mm256_mul_pd(sc, _mm256_sub_pd(dy, oy)));
+      minx = _mm_min_ps(minx, px);  miny = _mm_min_ps(miny, py);
+      maxx = _mm_max_ps(maxx, px);  maxy = _mm_max_ps(maxy, py);
+      _mm_storeu_ps((float*)(out + ii), _mm_unpacklo_ps(px, py));
+      _mm_storeu_ps((float*)(out + ii + 2), _mm_unpackhi_ps(px, py));
+      if(withArea) {
+        // previous points: (last[3], p[0], p[1], p[2])
+        __m128 qx = _mm_castsi128_ps(_mm_alignr_epi8(_mm_castps_si128(px), _mm_castps_si128(lastx), 12));
+        __m128 qy = _mm_castsi128_ps(_mm_alignr_epi8(_mm_castps_si128(py), _mm_castps_si128(lasty), 12));
+        __m256d a = _mm256_cvtps_pd(_mm_sub_ps(_mm_mul_ps(qx, py), _mm_mul_ps(px, qy)));
+        area = _mm256_add_pd(area, a);
+        cx = _mm256_add_pd(cx, _mm256_mul_pd(a, _mm256_cvtps_pd(_mm_add_ps(qx, px))));
+        cy = _mm256_add_pd(cy, _mm256_mul_pd(a, _mm256_cvtps_pd(_mm_add_ps(qy, py))));
+        lastx = px;  lasty = py;
+      }
+    }
+    b.min = vt_point(hmin4(minx), hmin4(miny));
+    b.max = vt_point(hmax4(maxx), hmax4(maxy));
+    b.area = hsum4(area);
+    b.centroid = {hsum4(cx), hsum4(cy)};
+  }
+#endif
+  for(; ii < n; ++ii) {
+    vt_point p(scale*(xs[ii] - origin.x), scale*(ys[ii] - origin.y));
+    out[ii] = p;
+    b.min = linalg::min(b.min, p);
+    b.max = linalg::max(b.max, p);
+    if(withArea && ii > 0) {
+      vt_point q = out[ii-1];
+      double a = q.x*p.y - p.x*q.y;
+      b.area += a;
+      b.centroid += a * linalg::vec<double,2>(q.x + p.x, q.y + p.y);
+    }
+  }
+  return b;
+}
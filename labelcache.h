@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+// label positions (polylabel, in mercator coords) of area features by TileBuilder::featKey(), shared by all tile
+//  builders, so polylabel runs once per feature instead of once for each zoom the feature's label appears at
+// - sharded like RingCache; entries are tiny, so instead of LRU, a shard is simply cleared when full
+class LabelCache
+{
+public:
+  static constexpr size_t NUM_SHARDS = 16;
+  static constexpr size_t ENTRY_BYTES = 48;  // approx. incl. hash table node
+  struct Label { int32_t x, y; };
+  static constexpr Label NO_LABEL = {INT32_MIN, INT32_MIN};  // polylabel failed, so centroid is used
+
+  LabelCache(size_t maxBytes) : m_maxShardEntries(maxBytes/ENTRY_BYTES/NUM_SHARDS) {}
+  bool get(uint64_t key, Label& label);
+  void put(uint64_t key, Label label);
+
+  size_t count() const { return m_count; }
+  size_t bytes() const { return m_count*ENTRY_BYTES; }
+
+  std::atomic_uint_fast64_t hits = 0, misses = 0, evictions = 0;
+
+private:
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Label> labels;
+  };
+
+  Shard m_shards[NUM_SHARDS];
+  std::atomic_size_t m_count = 0;
+  const size_t m_maxShardEntries;
+
+  Shard& shard(uint64_t key) { return m_shards[std::hash<uint64_t>()(key) % NUM_SHARDS]; }
+};
+
+inline bool LabelCache::get(uint64_t key, Label& label)
+{
+  Shard& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.labels.find(key);
+  if(it == s.labels.end()) { ++misses; return false; }
+  label = it->second;
+  ++hits;
+  return true;
+}
+
+inline void LabelCache::put(uint64_t key, Label label)
+{
+  if(m_maxShardEntries == 0) { return; }
+  Shard& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if(s.labels.size() >= m_maxShardEntries) {
+    evictions += s.labels.size();
+    m_count -= s.labels.size();
+    s.labels.clear();
+  }
+  if(s.labels.emplace(key, label).second) { ++m_count; }
+}
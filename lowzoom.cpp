@@ -0,0 +1,138 @@
+#include "lowzoom.h"
+
+using namespace geodesk;
+
+LowZoomStore::LowZoomStore(const Features& world, int maxZoom) : m_world(world), m_maxZoom(maxZoom)
+{
+  // 1/4 of TileBuilder simplification threshold (1/512 tile) at maxZoom, so output is nearly unchanged there
+  m_tolerance = Mercator::MAP_WIDTH/std::exp2(maxZoom)/512/4;
+}
+
+// mercator coords offset to unsigned, so top level bits give cell index at each level
+static uint32_t toUnsigned(int32_t v) { return uint32_t(v) ^ 0x80000000u; }
+
+uint64_t LowZoomStore::cellKey(int level, uint32_t ux, uint32_t uy)
+{
+  uint64_t morton = 0;
+  for(int ii = 0; ii < level; ++ii) {
+    uint32_t bx = (ux >> (31 - ii)) & 1, by = (uy >> (31 - ii)) & 1;
+    morton = morton << 2 | bx << 1 | by;
+  }
+  return uint64_t(level) << 56 | morton;
+}
+
+void LowZoomStore::find(const std::string& q, const geodesk::Box& box, int z, std::vector<Feature>& feats)
+{
+  Result* res;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& r = m_results[q];
+    if(!r) { r = std::make_unique<Result>(); }
+    res = r.get();
+  }
+  std::call_once(res->once, [&](){ extract(q, *res); });
+
+  // cell of tile at each level from tile center (tile box may be off by rounding)
+  z = std::min(z, m_maxZoom);
+  uint32_t ux = toUnsigned(box.minX()/2 + box.maxX()/2), uy = toUnsigned(box.minY()/2 + box.maxY()/2);
+  const auto& entries = res->entries;
+  auto cmp = [](const Entry& e, uint64_t key){ return e.cell < key; };
+  for(int level = 0; level <= m_maxZoom; ++level) {
+    // ancestor cell for level <= z, else range of all descendant cells
+    uint64_t lo = cellKey(std::min(level, z), ux, uy), hi = lo + 1;
+    if(level > z) {
+      int shift = 2*(level - z);
+      lo = uint64_t(level) << 56 | (lo & ((uint64_t(1) << 56) - 1)) << shift;
+      hi = lo + (uint64_t(1) << shift);
+    }
+    auto it = std::lower_bound(entries.begin(), entries.end(), lo, cmp);
+    for(; it != entries.end() && it->cell < hi; ++it) {
+      if(box.intersects(it->bounds)) { feats.push_back(it->feat); }
+    }
+  }
+}
+
+RingsPtr LowZoomStore::geometry(const Feature& f) const
+{
+  std::shared_lock<std::shared_mutex> lock(m_geomMutex);
+  auto it = m_geoms.find(TileBuilder::featKey(f));
+  return it != m_geoms.end() ? it->second : nullptr;
+}
+
+// Ramer-Douglas-Peucker on mercator coords; first and last points are always kept
+static void generalizeRing(const AssembledRings& src, const AssembledRings::Ring& r, double tol, AssembledRings& dst)
+{
+  const int32_t* xs = &src.x[r.start];
+  const int32_t* ys = &src.y[r.start];
+  std::vector<bool> keep(r.size, r.size < 3);
+  if(r.size >= 3) {
+    keep.front() = true;  keep.back() = true;
+    std::vector< std::pair<uint32_t, uint32_t> > stack = {{0, r.size - 1}};
+    while(!stack.empty()) {
+      auto [s, e] = stack.back();
+      stack.pop_back();
+      double dx = double(xs[e]) - xs[s], dy = double(ys[e]) - ys[s];
+      double l2 = dx*dx + dy*dy;
+      double maxdist2 = 0;
+      uint32_t argmax = 0;
+      for(uint32_t ii = s + 1; ii < e; ++ii) {
+        double px = double(xs[ii]) - xs[s], py = double(ys[ii]) - ys[s];
+        double t = l2 > 0 ? std::max(0.0, std::min(1.0, (px*dx + py*dy)/l2)) : 0;
+        double d2 = squared(px - t*dx) + squared(py - t*dy);
+        if(d2 > maxdist2) {
+          maxdist2 = d2;
+          argmax = ii;
+        }
+      }
+      if(maxdist2 < tol*tol) { continue; }
+      keep[argmax] = true;
+      stack.emplace_back(s, argmax);
+      stack.emplace_back(argmax, e);
+    }
+  }
+  uint32_t start = dst.x.size();
+  for(uint32_t ii = 0; ii < r.size; ++ii) {
+    if(keep[ii]) { dst.x.push_back(xs[ii]);  dst.y.push_back(ys[ii]); }
+  }
+  dst.rings.push_back({start, uint32_t(dst.x.size() - start), r.outer});
+}
+
+void LowZoomStore::extract(const std::string& q, Result& res)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  size_t npts = 0;
+  std::vector< std::pair<uint64_t, RingsPtr> > geoms;
+  for(Feature f : m_world(q.c_str())) {
+    geodesk::Box b = f.bounds();
+    uint32_t x0 = toUnsigned(b.minX()), x1 = toUnsigned(b.maxX()), y0 = toUnsigned(b.minY()), y1 = toUnsigned(b.maxY());
+    // deepest level at which bounds lie in a single cell
+    int level = std::min(m_maxZoom, std::min(x0 == x1 ? 32 : __builtin_clz(x0 ^ x1), y0 == y1 ? 32 : __builtin_clz(y0 ^ y1)));
+    res.entries.push_back({cellKey(level, x0, y0), f, b});
+    // nodes have no geometry to generalize; for other relations, members are read from GOL
+    if(f.isNode() || (!f.isWay() && !f.isArea())) { continue; }
+    uint64_t key = TileBuilder::featKey(f);
+    {
+      std::shared_lock<std::shared_mutex> lock(m_geomMutex);
+      if(m_geoms.count(key)) { continue; }  // already extracted for another query
+    }
+    RingsPtr src = f.isWay() ? TileBuilder::wayRings(f) : TileBuilder::assembleRings(f);
+    auto dst = std::make_shared<AssembledRings>();
+    for(const AssembledRings::Ring& r : src->rings) { generalizeRing(*src, r, m_tolerance, *dst); }
+    dst->x.shrink_to_fit();
+    dst->y.shrink_to_fit();
+    npts += dst->x.size();
+    geoms.emplace_back(key, std::move(dst));
+  }
+  std::stable_sort(res.entries.begin(), res.entries.end(),
+      [](const Entry& a, const Entry& b){ return a.cell < b.cell; });
+  res.entries.shrink_to_fit();
+  {
+    std::unique_lock<std::shared_mutex> lock(m_geomMutex);
+    for(auto& g : geoms) { m_geoms.emplace(std::move(g)); }
+  }
+  m_count += res.entries.size();
+  m_points += npts;
+  double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  LOG("Low zoom store: %d features (%d points) for %s extracted in %.1f s",
+      int(res.entries.size()), int(npts), q.c_str(), dt);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include "tilebuilder.h"
+
+// features matched by low zoom queries (TileBuilder::m_queries), extracted from GOL once per query instead of
+//  scanning the planet GOL for every z < 8 tile, with way and area geometry generalized (in mercator coords)
+//  for the highest zoom using the store, so tiles also avoid decoding full resolution geometry
+// - each query is extracted on first use; concurrent requests for the same query wait for the extraction
+// - features are bucketed by the smallest grid cell (at zoom <= maxZoom) containing their bounds and sorted
+//  by level and Morton code, so the candidates for a tile are one contiguous range per level
+// - relation members not matched by any query (e.g., untagged boundary ways) are still read from GOL
+class LowZoomStore
+{
+public:
+  LowZoomStore(const Features& world, int maxZoom = 7);
+  // append features matching q w/ bounds intersecting tile box (for tile at zoom z) to feats
+  void find(const std::string& q, const geodesk::Box& box, int z, std::vector<Feature>& feats);
+  RingsPtr geometry(const Feature& f) const;  // generalized geometry for way or area, or null
+
+  size_t count() const { return m_count; }
+  size_t points() const { return m_points; }
+
+private:
+  struct Entry { uint64_t cell; Feature feat; geodesk::Box bounds; };  // cell = level << 56 | Morton code
+  struct Result { std::once_flag once; std::vector<Entry> entries; };
+
+  void extract(const std::string& q, Result& res);
+  static uint64_t cellKey(int level, uint32_t ux, uint32_t uy);
+
+  const Features& m_world;
+  const int m_maxZoom;
+  double m_tolerance;  // in mercator units
+  std::mutex m_mutex;
+  std::map< std::string, std::unique_ptr<Result> > m_results;
+  mutable std::shared_mutex m_geomMutex;
+  std::unordered_map<uint64_t, RingsPtr> m_geoms;  // by TileBuilder::featKey()
+  std::atomic_size_t m_count = 0, m_points = 0;
+};
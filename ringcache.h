@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// rings of a multipolygon relation as assembled by Polygonizer, in mercator coords; each outer ring is followed
+//  by its inner rings
+struct AssembledRings
+{
+  struct Ring { uint32_t start, size; bool outer; };
+  std::vector<int32_t> x, y;
+  std::vector<Ring> rings;
+
+  size_t bytes() const { return sizeof(*this) + 2*x.size()*sizeof(int32_t) + rings.size()*sizeof(Ring); }
+};
+
+using RingsPtr = std::shared_ptr<const AssembledRings>;
+
+// LRU cache of assembled relation rings, shared by all tile and search index builders, so large relations
+//  (lakes, forests, parks, admin boundaries) are polygonized once instead of once per tile
+// - sharded like TileCache to limit contention between build threads
+class RingCache
+{
+public:
+  static constexpr size_t NUM_SHARDS = 16;
+  static constexpr size_t MIN_POINTS = 256;  // smaller relations are cheap to assemble, so not cached
+
+  RingCache(size_t maxBytes) : m_maxBytes(maxBytes) {}
+  RingsPtr get(int64_t relId);
+  void put(int64_t relId, RingsPtr rings);
+  void clear();
+
+  size_t bytes() const { return m_bytes; }
+  size_t count() const { return m_count; }
+
+  std::atomic_uint_fast64_t hits = 0, misses = 0, evictions = 0;
+
+private:
+  using lru_t = std::list< std::pair<int64_t, RingsPtr> >;
+  struct Shard {
+    std::mutex mutex;
+    lru_t lru;  // most recently used first
+    std::unordered_map<int64_t, lru_t::iterator> index;
+    size_t bytes = 0;
+  };
+
+  Shard m_shards[NUM_SHARDS];
+  std::atomic_size_t m_bytes = 0, m_count = 0;
+  const size_t m_maxBytes;
+
+  Shard& shard(int64_t relId) { return m_shards[std::hash<int64_t>()(relId) % NUM_SHARDS]; }
+  void remove(Shard& s, lru_t::iterator it);
+};
+
+inline RingsPtr RingCache::get(int64_t relId)
+{
+  Shard& s = shard(relId);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(relId);
+  if(it == s.index.end()) { ++misses; return {}; }
+  s.lru.splice(s.lru.begin(), s.lru, it->second);
+  ++hits;
+  return it->second->second;
+}
+
+inline void RingCache::put(int64_t relId, RingsPtr rings)
+{
+  const size_t shardBytes = m_maxBytes/NUM_SHARDS;
+  if(!rings || rings->x.size() < MIN_POINTS || rings->bytes() > shardBytes) { return; }
+  Shard& s = shard(relId);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(relId);
+  if(it != s.index.end()) { return; }  // another thread assembled it first
+  s.lru.emplace_front(relId, std::move(rings));
+  s.index.emplace(relId, s.lru.begin());
+  s.bytes += s.lru.front().second->bytes();
+  m_bytes += s.lru.front().second->bytes();
+  ++m_count;
+  while(s.bytes > shardBytes) {
+    s.index.erase(s.lru.back().first);
+    remove(s, std::prev(s.lru.end()));
+    ++evictions;
+  }
+}
+
+inline void RingCache::clear()
+{
+  for(Shard& s : m_shards) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    while(!s.lru.empty()) { remove(s, s.lru.begin()); }
+    s.index.clear();
+  }
+}
+
+// caller must hold shard lock and remove entry from index
+inline void RingCache::remove(Shard& s, lru_t::iterator it)
+{
+  s.bytes -= it->second->bytes();
+  m_bytes -= it->second->bytes();
+  --m_count;
+  s.lru.erase(it);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using SearchResult = std::shared_ptr<const std::string>;
+
+// LRU cache of /search results (JSON) keyed by normalized query, w/ entries expiring after ttl so that
+//  results follow a rebuilt search DB
+// - sharded like TileCache to limit contention between http threads
+class SearchCache
+{
+public:
+  static constexpr size_t NUM_SHARDS = 16;
+  using clock = std::chrono::steady_clock;
+
+  SearchCache(size_t maxBytes, int ttlSecs) : m_maxBytes(maxBytes), m_ttl(std::chrono::seconds(ttlSecs)) {}
+  SearchResult get(const std::string& key, bool countMiss = true);
+  void put(const std::string& key, SearchResult json);
+  void clear();
+
+  size_t bytes() const { return m_bytes; }
+  size_t count() const { return m_count; }
+
+  std::atomic_uint_fast64_t hits = 0, misses = 0, evictions = 0, prefixHits = 0;
+
+private:
+  struct Entry { std::string key; SearchResult json; clock::time_point expires; };
+  using lru_t = std::list<Entry>;
+  struct Shard {
+    std::mutex mutex;
+    lru_t lru;  // most recently used first
+    std::unordered_map<std::string, lru_t::iterator> index;
+    size_t bytes = 0;
+  };
+
+  Shard m_shards[NUM_SHARDS];
+  std::atomic_size_t m_bytes = 0, m_count = 0;
+  const size_t m_maxBytes;
+  const clock::duration m_ttl;
+
+  Shard& shard(const std::string& key) { return m_shards[std::hash<std::string>()(key) % NUM_SHARDS]; }
+  static size_t entryBytes(const Entry& e) { return sizeof(Entry) + 2*e.key.size() + e.json->size(); }
+  void remove(Shard& s, lru_t::iterator it);
+};
+
+inline SearchResult SearchCache::get(const std::string& key, bool countMiss)
+{
+  Shard& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(key);
+  if(it != s.index.end() && it->second->expires < clock::now()) {
+    remove(s, it->second);
+    s.index.erase(it);
+    it = s.index.end();
+  }
+  if(it == s.index.end()) {
+    if(countMiss) { ++misses; }
+    return {};
+  }
+  s.lru.splice(s.lru.begin(), s.lru, it->second);
+  ++hits;
+  return it->second->json;
+}
+
+inline void SearchCache::put(const std::string& key, SearchResult json)
+{
+  const size_t shardBytes = m_maxBytes/NUM_SHARDS;
+  if(!json || shardBytes == 0) { return; }
+  Shard& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(key);
+  if(it != s.index.end()) {
+    remove(s, it->second);
+    s.index.erase(it);
+  }
+  s.lru.push_front({key, std::move(json), clock::now() + m_ttl});
+  size_t n = entryBytes(s.lru.front());
+  if(n > shardBytes) { s.lru.pop_front();  return; }
+  s.index.emplace(key, s.lru.begin());
+  s.bytes += n;
+  m_bytes += n;
+  ++m_count;
+  while(s.bytes > shardBytes) {
+    s.index.erase(s.lru.back().key);
+    remove(s, std::prev(s.lru.end()));
+    ++evictions;
+  }
+}
+
+inline void SearchCache::clear()
+{
+  for(Shard& s : m_shards) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    while(!s.lru.empty()) { remove(s, s.lru.begin()); }
+    s.index.clear();
+  }
+}
+
+// caller must hold shard lock and remove entry from index
+inline void SearchCache::remove(Shard& s, lru_t::iterator it)
+{
+  size_t n = entryBytes(*it);
+  s.bytes -= n;
+  m_bytes -= n;
+  --m_count;
+  s.lru.erase(it);
+}
@@ -1,22 +1,35 @@
 // Serve tiles from multiple mbtiles files, generating missing tiles on demand
 
 #include <map>
+#include <deque>
 #include <fstream>
 #include "tilebuilder.h"
 #define SQLITEPP_LOGE LOG
 #define SQLITEPP_LOGW LOG
 #include "sqlitepp.h"
 #include "ulib.h"
+#include "tilecache.h"
+#include "tilesched.h"
+#include "lowzoom.h"
+#include "coverage.h"
+#include "searchcache.h"
+#include "archive.h"
 
 // httplib should be last include because it pulls in, e.g., fcntl.h with #defines that break geodesk headers
 //#define CPPHTTPLIB_OPENSSL_SUPPORT
 //#define CPPHTTPLIB_ZLIB_SUPPORT
 #include "httplib.h"
 
-extern std::string buildTile(const Features& world, const Features& ocean, TileID id);
+extern std::string buildTile(const Features& world, const Features& ocean, TileID id,
+    TileGeomStore* geomOut = nullptr, const std::vector<const TileGeomStore*>& geomIn = {});
 
-extern int buildSearchIndex(const Features& worldGOL, TileID toptile, const std::string& searchDBPath);
-extern std::string ftsQuery(const std::multimap<std::string, std::string>& params, const std::string& searchDBPath);
+extern void compileTagMatchers();
+extern int buildSearchIndex(const Features& worldGOL, TileID toptile, const std::string& searchDBPath,
+    int numShards = 1);
+extern int invalidateTiles(const Features& oldGOL, const Features& newGOL, const char* dbPath, int maxZ,
+    int numThreads);
+extern std::string ftsQuery(const std::multimap<std::string, std::string>& params, const std::string& searchDBPath,
+    SearchCache* cache = nullptr, bool* cacheHit = nullptr);
 
 // WAL allows simultaneous reading and writing
 static const char* schemaSQL = R"(PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;
@@ -26,25 +39,242 @@ BEGIN;
     tile_column INTEGER,
     tile_row INTEGER,
     tile_data BLOB,
-    created_at INTEGER DEFAULT (CAST(strftime('%s') AS INTEGER))
+    created_at INTEGER DEFAULT (CAST(strftime('%s') AS INTEGER)),
+    stale INTEGER DEFAULT 0
   );
   CREATE UNIQUE INDEX IF NOT EXISTS tile_index on tiles (zoom_level, tile_column, tile_row);
+  CREATE TABLE IF NOT EXISTS tiles_zstd (
+    zoom_level INTEGER,
+    tile_column INTEGER,
+    tile_row INTEGER,
+    tile_data BLOB,
+    created_at INTEGER DEFAULT (CAST(strftime('%s') AS INTEGER))
+  );
+  CREATE UNIQUE INDEX IF NOT EXISTS tile_zstd_index on tiles_zstd (zoom_level, tile_column, tile_row);
 COMMIT;)";
 
+// stale column (set by --invalidate, cleared when tile is replaced) is added to DBs created before it existed
+static const char* hasStaleSQL = "SELECT COUNT(1) FROM pragma_table_info('tiles') WHERE name = 'stale';";
+static const char* staleSchemaSQL = "CREATE INDEX IF NOT EXISTS tile_stale_index ON tiles (stale) WHERE stale = 1;";
+static const char* getStaleSQL =
+    "SELECT zoom_level, tile_column, tile_row FROM tiles WHERE stale = 1 LIMIT ?;";
+
+static const char* hasTileSQL =
+    "SELECT 1 FROM tiles WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?;";
 static const char* getTileSQL =
     "SELECT tile_data FROM tiles WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?;";
 static const char* putTileSQL =
     "REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?,?,?,?);";
+// zstd tiles (tile_data in tiles is gzip per mbtiles spec) are transcoded from gzip tiles as needed
+// - zstd tile is deleted in the same transaction that replaces its gzip tile, and is only written if the gzip
+//  tile it was transcoded from (?5) is still current, so a zstd tile is never older than its gzip tile
+// - created_at check is for DBs written before zstd tiles were deleted on replace
+static const char* getTileZstdSQL = "SELECT zs.tile_data FROM tiles_zstd zs JOIN tiles gz"
+    " ON zs.zoom_level = gz.zoom_level AND zs.tile_column = gz.tile_column AND zs.tile_row = gz.tile_row"
+    " WHERE zs.zoom_level = ? AND zs.tile_column = ? AND zs.tile_row = ? AND zs.created_at >= gz.created_at;";
+static const char* putTileZstdSQL = "REPLACE INTO tiles_zstd (zoom_level, tile_column, tile_row, tile_data)"
+    " SELECT ?1, ?2, ?3, ?4 WHERE EXISTS (SELECT 1 FROM tiles"
+    " WHERE zoom_level = ?1 AND tile_column = ?2 AND tile_row = ?3 AND tile_data = ?5);";
+static const char* delTileZstdSQL =
+    "DELETE FROM tiles_zstd WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?;";
 
 class TileDB : public SQLiteDB
 {
 public:
   SQLiteStmt getTile = {NULL};
   SQLiteStmt putTile = {NULL};
+  SQLiteStmt getTileZstd = {NULL};
+  SQLiteStmt putTileZstd = {NULL};
+  SQLiteStmt delTileZstd = {NULL};
+  SQLiteStmt getStale = {NULL};
+  SQLiteStmt hasTileStmt = {NULL};
+
+  TileBlob readTile(SQLiteStmt& query, TileID id)
+  {
+    TileBlob blob;
+    query.bind(id.z, id.x, id.yTMS()).exec([&](sqlite3_stmt* stmt){
+      const char* data = (const char*) sqlite3_column_blob(stmt, 0);
+      const int length = sqlite3_column_bytes(stmt, 0);
+      blob = std::make_shared<const std::string>(data ? std::string(data, length) : std::string());
+    });
+    return blob;
+  }
+
+  bool hasTile(TileID id)
+  {
+    int found = 0;
+    return hasTileStmt.bind(id.z, id.x, id.yTMS()).onerow(found) && found;
+  }
 };
 
 thread_local TileDB worldDB;
 
+// single thread writing tiles to DB w/ many tiles per transaction, so each tile doesn't pay for a WAL commit
+// - a batch is committed once maxBatch tiles are queued or maxDelayMs after first tile is queued
+// - push() blocks while queue is full so that builders can't get too far ahead of writer
+class TileWriter
+{
+public:
+  TileWriter(size_t maxQueue, size_t maxBatch, int maxDelayMs)
+      : m_maxQueue(maxQueue), m_maxBatch(maxBatch), m_maxDelay(maxDelayMs) {}
+  ~TileWriter();
+  bool open(const char* path);
+  // for zstd tile, gzSrc is gzip tile it was transcoded from
+  void push(TileID id, TileBlob blob, std::function<void()> onSaved = {}, TileBlob gzSrc = {});
+  size_t queueDepth() { std::lock_guard<std::mutex> lock(m_mutex);  return m_queue.size(); }
+
+  std::atomic_uint_fast64_t commits = 0, tilesWritten = 0, lastBatch = 0, maxBatch = 0;
+
+private:
+  struct Item { TileID id; TileBlob blob; std::function<void()> onSaved; TileBlob gzSrc; };
+  void run();
+  void write(std::vector<Item>& batch);
+
+  TileDB m_db;
+  std::deque<Item> m_queue;
+  std::mutex m_mutex;
+  std::condition_variable m_queueCv;  // signaled when tile added or stop requested
+  std::condition_variable m_spaceCv;  // signaled when tiles removed from queue
+  std::thread m_thread;
+  bool m_stop = false;
+  const size_t m_maxQueue, m_maxBatch;
+  const std::chrono::milliseconds m_maxDelay;
+};
+
+bool TileWriter::open(const char* path)
+{
+  if(m_db.open(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) != SQLITE_OK) { return false; }
+  if(!m_db.exec(schemaSQL)) { return false; }
+  int hasStale = 0;
+  m_db.stmt(hasStaleSQL).onerow(hasStale);
+  if(!hasStale && !m_db.exec("ALTER TABLE tiles ADD COLUMN stale INTEGER DEFAULT 0;")) { return false; }
+  if(!m_db.exec(staleSchemaSQL)) { return false; }
+  m_db.putTile = m_db.stmt(putTileSQL);
+  m_db.putTileZstd = m_db.stmt(putTileZstdSQL);
+  m_db.delTileZstd = m_db.stmt(delTileZstdSQL);
+  m_thread = std::thread(&TileWriter::run, this);
+  return true;
+}
+
+void TileWriter::push(TileID id, TileBlob blob, std::function<void()> onSaved, TileBlob gzSrc)
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_spaceCv.wait(lock, [&](){ return m_queue.size() < m_maxQueue; });
+    m_queue.push_back({id, std::move(blob), std::move(onSaved), std::move(gzSrc)});
+  }
+  m_queueCv.notify_one();
+}
+
+void TileWriter::run()
+{
+  std::vector<Item> batch;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for(;;) {
+    m_queueCv.wait(lock, [&](){ return m_stop || !m_queue.empty(); });
+    if(m_queue.empty()) { return; }  // stop requested and nothing left to write
+    m_queueCv.wait_for(lock, m_maxDelay, [&](){ return m_stop || m_queue.size() >= m_maxBatch; });
+    size_t n = std::min(m_queue.size(), m_maxBatch);
+    batch.assign(std::make_move_iterator(m_queue.begin()), std::make_move_iterator(m_queue.begin() + n));
+    m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+    lock.unlock();
+    m_spaceCv.notify_all();
+    write(batch);
+    batch.clear();
+    lock.lock();
+  }
+}
+
+void TileWriter::write(std::vector<Item>& batch)
+{
+  m_db.exec("BEGIN;");
+  for(Item& item : batch) {
+    TileID id = item.id;
+    SQLiteStmt& putTile = item.gzSrc ? m_db.putTileZstd : m_db.putTile;
+    putTile.bind(id.z, id.x, id.yTMS());
+    sqlite3_bind_blob(putTile.stmt, 4, item.blob->data(), item.blob->size(), SQLITE_STATIC);
+    if(item.gzSrc) { sqlite3_bind_blob(putTile.stmt, 5, item.gzSrc->data(), item.gzSrc->size(), SQLITE_STATIC); }
+    if(!putTile.exec())
+      LOG("Error adding tile %s to DB: %s", id.toString().c_str(), m_db.errMsg());
+    // zstd tile transcoded from replaced gzip tile is out of date
+    if(!item.gzSrc && !m_db.delTileZstd.bind(id.z, id.x, id.yTMS()).exec())
+      LOG("Error deleting zstd tile %s from DB: %s", id.toString().c_str(), m_db.errMsg());
+  }
+  if(!m_db.exec("COMMIT;"))
+    LOG("Error committing %d tiles to DB: %s", int(batch.size()), m_db.errMsg());
+  ++commits;
+  tilesWritten += batch.size();
+  lastBatch = batch.size();
+  if(batch.size() > maxBatch) { maxBatch = batch.size(); }
+  for(Item& item : batch) {
+    if(item.onSaved) { item.onSaved(); }
+  }
+}
+
+// writes all queued tiles before returning
+TileWriter::~TileWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_queueCv.notify_all();
+  if(m_thread.joinable()) { m_thread.join(); }
+}
+
+static const char* MVT_MIME = "application/vnd.mapbox-vector-tile";
+
+// serve tile data kept alive by owner (shared_ptr or shared_future) w/o copying to res.body
+template<class T>
+static void setTileContent(httplib::Response& res, std::string_view data, T owner)
+{
+  if(data.empty()) { res.set_content("", 0, MVT_MIME); return; }
+  res.set_content_provider(data.size(), MVT_MIME,
+      [data, owner](size_t offset, size_t length, httplib::DataSink& sink){
+        return sink.write(data.data() + offset, length);
+      });
+}
+
+// true if Accept-Encoding header lists encoding (w/o q=0)
+static bool acceptsEncoding(const httplib::Request& req, const char* encoding)
+{
+  for(const std::string& item : splitStr<std::vector>(req.get_header_value("Accept-Encoding"), ",")) {
+    size_t start = item.find_first_not_of(' ');
+    if(start == std::string::npos) { continue; }
+    size_t end = item.find_first_of(" ;", start);
+    if(item.compare(start, end - start, encoding) != 0) { continue; }
+    size_t q = item.find("q=", end);
+    return q == std::string::npos || atof(item.c_str() + q + 2) > 0;
+  }
+  return false;
+}
+
+// tile containing lng,lat at zoom z
+static TileID lngLatTile(double lng, double lat, int z)
+{
+  int n = 1 << z;
+  double latr = std::max(-85.0511, std::min(lat, 85.0511))*M_PI/180;
+  int x = int(std::floor((lng + 180)/360*n));
+  int y = int(std::floor((1 - std::log(std::tan(latr) + 1/std::cos(latr))/M_PI)/2*n));
+  return TileID(std::max(0, std::min(x, n - 1)), std::max(0, std::min(y, n - 1)), z);
+}
+
+// distance of x,y along Hilbert curve filling 2^order x 2^order grid
+static uint64_t hilbertIndex(int order, uint32_t x, uint32_t y)
+{
+  uint64_t d = 0;
+  for(uint32_t s = (1u << order) >> 1; s > 0; s >>= 1) {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    d += uint64_t(s) * s * ((3 * rx) ^ ry);
+    if(ry == 0) {
+      if(rx == 1) { x = s - 1 - x;  y = s - 1 - y; }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
 // sigwait would be an alternative approach
 static std::function<void()> onSigInt;
 static void sigint_handler(int s)
@@ -71,7 +301,9 @@ int main(int argc, char* argv[])
 {
   struct Stats_t {
     std::atomic_uint_fast64_t reqs = 0, reqsok = 0, bytesout = 0, tilesbuilt = 0, ofltiles = 0,
-        reqscached = 0, searchok = 0, nscached = 0, nsbuilt = 0, nssearch = 0;
+        reqscached = 0, searchok = 0, nscached = 0, nsbuilt = 0, nssearch = 0, emptytiles = 0,
+        searchcached = 0, nssearchcached = 0, stalebuilt = 0, prefetched = 0, warmed = 0, prefetchhits = 0,
+        archivetiles = 0, reqsrejected = 0, reqstimeout = 0;
   } stats;
 
   std::signal(SIGINT, sigint_handler);
@@ -81,11 +313,37 @@ int main(int argc, char* argv[])
   const char* searchDBPath = "fts.sqlite";
   int tcpPort = 8080;
   int numBuildThreads = std::max(2U, std::thread::hardware_concurrency()) - 1;
+  int numHttpThreads = 0;  // default set after options parsed
+  int maxBuildWaiters = -1;
+  int buildTimeoutSecs = 30;
+  int keepAliveMax = 100;
+  int keepAliveSecs = 3;
   TileID topTile(-1, -1, -1);
   int maxZ = 14;
+  int pyramidZ = -1;
+  int unitZoom = 8;
+  int cacheMB = 256;  // most requests are for a small fraction of tiles
+  int ringCacheMB = 256;
+  int labelCacheMB = 32;
+  int searchCacheMB = 32;
+  int searchCacheTTL = 3600;
+  bool useLowZoomStore = true;
+  std::string coveragePath;
+  TileCompressor* zstdComp = nullptr;
+  CompressLevels zstdLevels(19);  // zstd tiles are made once and served many times, so favor ratio
   std::string adminKey;
   std::fstream logStream;
   bool buildFTS = false;
+  int ftsShards = 1;
+  const char* oldGOLPath = nullptr;
+  int rebuildStale = 0;
+  int prefetchBudget = 0;
+  const char* exportPath = nullptr;
+  const char* archivePath = nullptr;
+  struct WarmSpec { double lng0, lat0, lng1, lat1; int z0, z1; };
+  std::vector<WarmSpec> warmSpecs;
+  struct WarmRange { int z, x0, y0, x1, y1; };
+  std::vector<WarmRange> warmTiles;  // in zoom order for each spec
 
   int argi = 1;
   for(; argi < argc-1; argi += 2) {
@@ -93,6 +351,18 @@ int main(int argc, char* argv[])
       tcpPort = atoi(argv[argi+1]);
     else if(strcmp(argv[argi], "--threads") == 0)
       numBuildThreads = std::max(1, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--http-threads") == 0)
+      numHttpThreads = std::max(2, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--max-waiting") == 0)
+      maxBuildWaiters = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--build-timeout") == 0)
+      buildTimeoutSecs = std::max(1, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--keep-alive") == 0) {
+      if(sscanf(argv[argi+1], "%d,%d", &keepAliveMax, &keepAliveSecs) != 2 || keepAliveMax < 1 || keepAliveSecs < 0) {
+        LOG("Invalid keep-alive spec %s (expected max requests,timeout seconds)", argv[argi+1]);
+        return -1;
+      }
+    }
     else if(strcmp(argv[argi], "--db") == 0)
       worldDBPath = argv[argi+1];
     else if(strcmp(argv[argi], "--build") == 0) {
@@ -106,6 +376,40 @@ int main(int argc, char* argv[])
     }
     else if(strcmp(argv[argi], "--maxz") == 0)
       maxZ = atoi(argv[argi+1]);
+    else if(strcmp(argv[argi], "--unitz") == 0)
+      unitZoom = atoi(argv[argi+1]);
+    else if(strcmp(argv[argi], "--pyramid") == 0)
+      pyramidZ = atoi(argv[argi+1]);
+    else if(strcmp(argv[argi], "--gzip-level") == 0) {
+      if(!TileBuilder::gzipLevels.parse(argv[argi+1])) {
+        LOG("Invalid compression level spec %s (expected, e.g., 6,12:5)", argv[argi+1]);
+        return -1;
+      }
+    }
+    else if(strcmp(argv[argi], "--zstd") == 0) {
+      if(!(zstdComp = TileCompressor::zstd())) {
+        LOG("zstd not available (rebuild with USE_ZSTD=1)");
+        return -1;
+      }
+      if(!zstdLevels.parse(argv[argi+1])) {
+        LOG("Invalid compression level spec %s (expected, e.g., 19,12:15)", argv[argi+1]);
+        return -1;
+      }
+    }
+    else if(strcmp(argv[argi], "--cache-mb") == 0)
+      cacheMB = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--ring-cache-mb") == 0)
+      ringCacheMB = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--label-cache-mb") == 0)
+      labelCacheMB = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--search-cache-mb") == 0)
+      searchCacheMB = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--search-cache-ttl") == 0)
+      searchCacheTTL = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--lowzoom-store") == 0)
+      useLowZoomStore = atoi(argv[argi+1]) != 0;
+    else if(strcmp(argv[argi], "--coverage") == 0)
+      coveragePath = argv[argi+1];
     else if(strcmp(argv[argi], "--admin-key") == 0)
       adminKey = argv[argi+1];
     else if(strcmp(argv[argi], "--log") == 0) {
@@ -119,6 +423,28 @@ int main(int argc, char* argv[])
       searchDBPath = argv[argi+1];
     else if(strcmp(argv[argi], "--buildfts") == 0)
       buildFTS = true;
+    else if(strcmp(argv[argi], "--fts-shards") == 0)
+      ftsShards = atoi(argv[argi+1]);
+    else if(strcmp(argv[argi], "--invalidate") == 0)
+      oldGOLPath = argv[argi+1];
+    else if(strcmp(argv[argi], "--rebuild-stale") == 0)
+      rebuildStale = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--export") == 0)
+      exportPath = argv[argi+1];
+    else if(strcmp(argv[argi], "--archive") == 0)
+      archivePath = argv[argi+1];
+    else if(strcmp(argv[argi], "--tile-budget-kb") == 0)
+      TileBuilder::maxTileBytes = size_t(std::max(0, atoi(argv[argi+1]))) << 10;
+    else if(strcmp(argv[argi], "--prefetch") == 0)
+      prefetchBudget = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--warm") == 0) {
+      WarmSpec w;
+      if(sscanf(argv[argi+1], "%lf,%lf,%lf,%lf,%d,%d", &w.lng0, &w.lat0, &w.lng1, &w.lat1, &w.z0, &w.z1) != 6) {
+        LOG("Invalid warm spec %s (expected minlng,minlat,maxlng,maxlat,minz,maxz)", argv[argi+1]);
+        return -1;
+      }
+      warmSpecs.push_back(w);
+    }
     else
       break;
   }
@@ -129,72 +455,380 @@ Optional arguments:
   --db <mbtiles file>: sqlite file to store generated tiles; default is planet.mbtiles
   --port <port number>: TCP port to listen on; default is 8080
   --threads <n>: number of tile builder threads; default is CPU cores - 1
+  --http-threads <n>: number of HTTP threads (each connection uses one while open); default is 2x
+    builder threads (at least 8)
+  --max-waiting <n>: max requests waiting for tile builds, beyond which requests for unbuilt tiles get 503
+    (tile is still built), so some HTTP threads are always free for cached tiles; default is 3/4 of HTTP threads
+  --build-timeout <s>: seconds a request waits for a tile build before 504 (build continues); default is 30
+  --keep-alive <n>,<s>: max requests per connection and idle timeout in seconds; default is 100,3
   --build <z>/<x>/<y>: build tile z/x/y and all children to maxz, then exit (no server)
   --maxz <z>: maximum tile zoom level; default is 14
+  --unitz <z>: with --build, each z<z> subtree is built depth-first by one thread; default is 8
+  --pyramid <z>: with --build, build tiles at zoom >= z (and < maxz) from geometry saved by child tiles
+  --cache-mb <n>: size of in-memory tile cache in MB (0 to disable); default is 256
+  --ring-cache-mb <n>: size of cache of assembled multipolygon relations in MB (0 to disable); default is 256
+  --label-cache-mb <n>: size of cache of area label positions (polylabel) in MB (0 to disable); default is 32
+  --search-cache-mb <n>: size of /search result cache in MB (0 to disable); default is 32
+  --search-cache-ttl <s>: seconds before cached /search results expire; default is 3600
+  --lowzoom-store <0|1>: build z < 8 tiles from features extracted once from GOL w/ generalized geometry; default is 1
+  --coverage <file|1>: use ocean/land coverage bitmap, loaded from file or built (and saved to file) if missing,
+    to serve empty ocean and land tiles w/o building or saving them; 1 to build w/o saving
+  --gzip-level <spec>: gzip level for built tiles, optionally per zoom, e.g. 6,12:5 for 5 at z >= 12; default is 5
+  --zstd <spec>: serve zstd tiles to clients accepting zstd, using level <spec> (as for --gzip-level)
+  --tile-budget-kb <n>: rebuild tiles larger than n KB (after compression) w/o features of highest min zoom
+    (and smallest areas) until under budget; default is 0 (no limit)
+  --invalidate <old gol file>: mark tiles in DB affected by features changed since old GOL as stale, then exit
+  --rebuild-stale <n>: rebuild stale tiles in background, keeping up to n queued; stale tiles are served until
+    rebuilt; default is 0 (disabled)
+  --export <pmtiles file>: write all tiles in DB (e.g., after --build) to PMTiles archive, then exit
+  --archive <pmtiles file>: serve tiles from archive (memory mapped) when present, else from DB or built
+  --prefetch <n>: after building a tile for a request, queue background builds for its uncached neighbors and
+    children while fewer than n background builds are waiting; default is 0 (disabled)
+  --warm <minlng,minlat,maxlng,maxlat,minz,maxz>: build missing tiles in bounds, in zoom order, when build threads
+    are idle
 )");
     return -1;
   }
 
-  Features worldGOL(argv[argi]);
-  Features oceanGOL(argv[argi+1]);
-  LOG("Loaded %s and %s", argv[argi], argv[argi+1]);
+  // export doesn't need GOL
+  if(exportPath) {
+    sqlite3_config(SQLITE_CONFIG_MULTITHREAD);
+    return exportArchive(worldDBPath, exportPath);
+  }
+
+  // --maxz may follow --warm, so zooms are clamped once all options are read (tiles above maxZ are never served)
+  for(const WarmSpec& w : warmSpecs) {
+    for(int z = std::max(0, w.z0); z <= std::min(w.z1, maxZ); ++z) {
+      TileID t0 = lngLatTile(std::min(w.lng0, w.lng1), std::max(w.lat0, w.lat1), z);
+      TileID t1 = lngLatTile(std::max(w.lng0, w.lng1), std::min(w.lat0, w.lat1), z);
+      warmTiles.push_back({z, t0.x, t0.y, t1.x, t1.y});
+    }
+  }
+
+  if(numHttpThreads <= 0) { numHttpThreads = std::max(8, 2*numBuildThreads); }
+  if(maxBuildWaiters < 0) { maxBuildWaiters = numHttpThreads*3/4; }
+
+  // open GOL files and create caches for them; also used to swap GOL (/admin/gol)
+  auto loadGol = [&](const char* worldPath, const char* oceanPath, int version){
+    auto gol = std::make_shared<GolVersion>(worldPath, oceanPath, version);
+    LOG("Loaded %s and %s (GOL version %d)", worldPath, oceanPath, version);
+    GolVersion::Scope scope(gol);
+    if(ringCacheMB > 0) { gol->ringCache = std::make_unique<RingCache>(size_t(ringCacheMB) << 20); }
+    if(labelCacheMB > 0) { gol->labelCache = std::make_unique<LabelCache>(size_t(labelCacheMB) << 20); }
+    compileTagMatchers();  // resolve schema tag values to GOL string codes
+    if(useLowZoomStore && !buildFTS) { gol->lowZoomStore = std::make_unique<LowZoomStore>(gol->world); }
+    if(!coveragePath.empty() && !buildFTS) {
+      // saved coverage is for the GOL we started with, so rebuild (and save) for new version
+      bool persist = coveragePath != "1";
+      gol->coverage = std::make_unique<OceanCoverage>();
+      if(!persist || version > 0 || !gol->coverage->load(coveragePath.c_str())) {
+        gol->coverage->build(gol->ocean);
+        if(persist && !gol->coverage->save(coveragePath.c_str()))
+          LOG("Error saving ocean coverage to %s", coveragePath.c_str());
+      }
+    }
+    return gol;
+  };
+  GolVersion::setActive(loadGol(argv[argi], argv[argi+1], 0));
+  // for batch modes only (--build, etc.), which never swap GOL
+  const Features& worldGOL = GolVersion::current().world;
+  const Features& oceanGOL = GolVersion::current().ocean;
 
-  TileBuilder::worldFeats = &worldGOL;
+  // empty ocean or land tile w/o build, or null
+  auto emptyTile = [&](TileID id){
+    GolVersion::Scope scope(GolVersion::active());
+    const GolVersion& gol = GolVersion::current();
+    if(!gol.coverage) { return TileBlob(); }
+    return gol.coverage->emptyTile(gol.world, id, [&](){ return buildTile(gol.world, gol.ocean, id); });
+  };
+  // build w/ active GOL, which is kept alive until build finishes even if swapped
+  auto buildActive = [](TileID id){
+    GolVersion::Scope scope(GolVersion::active());
+    const GolVersion& gol = GolVersion::current();
+    return std::make_shared<const std::string>(buildTile(gol.world, gol.ocean, id));
+  };
   sqlite3_config(SQLITE_CONFIG_MULTITHREAD);  // should be OK since our DB object is declared thread_local
 
   if(buildFTS) {
-    return buildSearchIndex(worldGOL, TileID(0, 0, 0), searchDBPath);
+    return buildSearchIndex(worldGOL, TileID(0, 0, 0), searchDBPath, ftsShards);
   }
 
-  // ... separate queues for high zoom and low zoom (slower build)?
-  std::mutex buildMutex;
-  std::map< TileID, std::shared_future<std::string> > buildQueue;
-  ThreadPool buildWorkers(numBuildThreads);
-  ThreadPool dbWriter(1);  // ThreadPool(1) is like AsyncWorker
-
-  // have to serialize DB writes, so use a single worker thread
-  auto dbfut = dbWriter.enqueue([&](){
-    if(worldDB.open(worldDBPath, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) != SQLITE_OK) { return false; }
-    if(!worldDB.exec(schemaSQL)) { return false; }
-    worldDB.putTile = worldDB.stmt(putTileSQL);
-    return true;
-  });
-  if(!dbfut.get()) {
+  // have to serialize DB writes, so use a single writer thread; up to 1024 queued tiles, 256 per commit
+  // - declared before build threads so it outlives any build still pushing tiles
+  TileWriter dbWriter(1024, 256, 100);
+  if(!dbWriter.open(worldDBPath)) {
     LOG("Error opening world mbtiles %s\n", worldDBPath);
     return -1;
   }
 
+  if(oldGOLPath) {
+    Features oldGOL(oldGOLPath);
+    LOG("Loaded %s", oldGOLPath);
+    return invalidateTiles(oldGOL, worldGOL, worldDBPath, maxZ, numBuildThreads);
+  }
+
   auto time0 = std::chrono::steady_clock::now();
   auto time1 = time0;
   clock_t clock0 = clock();
   if(topTile.isValid()) {
-    std::function<void(TileID)> buildFn = [&](TileID id){
-      LOG("Building %s", id.toString().c_str());
+    WorkStealingPool buildWorkers(numBuildThreads);
+    std::atomic_bool stopBuild = false;
+    std::mutex reportMutex;
+    std::condition_variable reportCv;
+    bool buildDone = false;
+    // at least 64 units (or all maxZ tiles) so all workers have something to do
+    int unitZ = std::min(maxZ, std::max(unitZoom, topTile.z + 3));
+    auto saveTile = [&](TileID id, std::string&& mvt){
+      if(!mvt.empty()) { dbWriter.push(id, std::make_shared<const std::string>(std::move(mvt))); }
+    };
+
+    // pyramid build: tiles at z >= pyramidZ are built bottom-up, w/ each parent built (once all four children
+    //  are done) from the features and geometry saved by its children instead of querying GOL
+    using GeomStores = std::vector<std::unique_ptr<TileGeomStore>>;
+    std::mutex pyramidMutex;
+    std::map<TileID, GeomStores> pyramidPending;
+    std::function<void(TileID, GeomStores)> pyramidFn = [&](TileID id, GeomStores children){
+      LOG("Building %s from %d children", id.toString().c_str(), int(children.size()));
       ++stats.tilesbuilt;
-      std::string mvt = buildTile(worldGOL, oceanGOL, id);
-      if(!mvt.empty()) {
-        dbWriter.enqueue([&, mvt = std::move(mvt), id](){
-          worldDB.putTile.bind(id.z, id.x, id.yTMS());
-          sqlite3_bind_blob(worldDB.putTile.stmt, 4, mvt.data(), mvt.size(), SQLITE_STATIC);
-          if(!worldDB.putTile.exec())
-            LOG("Error adding tile %s to DB: %s", id.toString().c_str(), worldDB.errMsg());
+      std::vector<const TileGeomStore*> geomIn;
+      for(auto& child : children) { geomIn.push_back(child.get()); }
+      bool istop = id.z <= pyramidZ || id == topTile;
+      auto geomOut = istop ? nullptr : std::make_unique<TileGeomStore>(id);
+      saveTile(id, buildTile(worldGOL, oceanGOL, id, geomOut.get(), geomIn));
+      children.clear();
+      if(istop) { return; }
+
+      TileID parent = id.getParent();
+      GeomStores siblings;
+      {
+        std::lock_guard<std::mutex> lock(pyramidMutex);
+        auto it = pyramidPending.try_emplace(parent).first;
+        it->second.push_back(std::move(geomOut));
+        if(it->second.size() < 4) { return; }
+        siblings = std::move(it->second);
+        pyramidPending.erase(it);
+      }
+      // stay on this thread if parent is inside a unit so unit is built depth-first
+      if(parent.z >= unitZ) { pyramidFn(parent, std::move(siblings)); }
+      else {
+        buildWorkers.post([&, parent, siblings = std::move(siblings)]() mutable {
+          pyramidFn(parent, std::move(siblings));
         });
       }
+    };
+
+    // build tile and all children depth-first on current thread
+    std::function<void(TileID)> buildFn = [&](TileID id){
+      if(stopBuild) { return; }
+      bool pyramid = pyramidZ >= 0 && id.z >= pyramidZ;
+      // all descendants of an empty ocean or land tile are also empty, so skip whole subtree
+      if(!pyramid && emptyTile(id)) {
+        for(int z = id.z; z <= maxZ; ++z) { stats.emptytiles += uint64_t(1) << 2*(z - id.z); }
+        return;
+      }
+      if(!pyramid) {
+        LOG("Building %s", id.toString().c_str());
+        ++stats.tilesbuilt;
+        saveTile(id, buildTile(worldGOL, oceanGOL, id));
+      }
       if(id.z < maxZ) {
         for(int ii = 0; ii < 4; ++ii)
-          buildWorkers.enqueue(buildFn, id.getChild(ii, maxZ));
+          buildFn(id.getChild(ii, maxZ));
       }
+      else if(pyramid)
+        pyramidFn(id, {});
     };
-    onSigInt = [&](){ buildWorkers.requestStop(true); };
-    buildWorkers.enqueue(buildFn, topTile);
+    onSigInt = [&](){ stopBuild = true;  buildWorkers.requestStop(true); };
+
+    // tiles above unitZ are built individually; below, each unitZ subtree (unit) is built by a single worker,
+    //  with units taken in Hilbert curve order so the GOL pages touched by concurrent units mostly overlap
+    for(int z = topTile.z; z < unitZ; ++z) {
+      if(pyramidZ >= 0 && z >= pyramidZ) { break; }
+      int dz = z - topTile.z;
+      for(int x = topTile.x << dz; x < (topTile.x + 1) << dz; ++x) {
+        for(int y = topTile.y << dz; y < (topTile.y + 1) << dz; ++y) {
+          buildWorkers.post([&, id = TileID(x, y, z)](){
+            if(stopBuild) { return; }
+            if(emptyTile(id)) { ++stats.emptytiles;  return; }
+            LOG("Building %s", id.toString().c_str());
+            ++stats.tilesbuilt;
+            saveTile(id, buildTile(worldGOL, oceanGOL, id));
+          });
+        }
+      }
+    }
+    int udz = unitZ - topTile.z;
+    std::vector<TileID> units;
+    for(int x = topTile.x << udz; x < (topTile.x + 1) << udz; ++x) {
+      for(int y = topTile.y << udz; y < (topTile.y + 1) << udz; ++y)
+        units.emplace_back(x, y, unitZ);
+    }
+    std::sort(units.begin(), units.end(), [&](const TileID& a, const TileID& b){
+      return hilbertIndex(udz, a.x, a.y) < hilbertIndex(udz, b.x, b.y);
+    });
+    std::atomic_size_t nextUnit = 0;
+    for(int ii = 0; ii < numBuildThreads; ++ii) {
+      buildWorkers.post([&](){
+        size_t idx;
+        while(!stopBuild && (idx = nextUnit++) < units.size()) { buildFn(units[idx]); }
+      });
+    }
+
+    // progress report
+    uint64_t totalTiles = 0;
+    for(int z = topTile.z; z <= maxZ; ++z) { totalTiles += uint64_t(1) << 2*(z - topTile.z); }
+    std::thread reporter([&](){
+      std::unique_lock<std::mutex> lock(reportMutex);
+      while(!reportCv.wait_for(lock, std::chrono::seconds(15), [&](){ return buildDone; })) {
+        double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - time0).count();
+        uint64_t ntiles = stats.tilesbuilt.load() + stats.emptytiles.load();
+        double tps = ntiles/dt;
+        double fps = TileBuilder::totalFeats/dt;
+        double eta = tps > 0 ? (totalTiles - std::min(ntiles, totalTiles))/tps : 0;
+        LOG("Progress: %lu/%lu tiles (%.1f%%) in %.0fs; %.1f tiles/s, %.0f features/s; ETA %.0fs (unit %d/%d)",
+            ntiles, totalTiles, 100.0*ntiles/totalTiles, dt, tps, fps, eta,
+            int(std::min(nextUnit.load(), units.size())), int(units.size()));
+      }
+    });
+
     buildWorkers.waitForIdle();
+    { std::lock_guard<std::mutex> lock(reportMutex);  buildDone = true; }
+    reportCv.notify_all();
+    reporter.join();
     auto t1 = std::chrono::steady_clock::now();
     double dt = std::chrono::duration<double>(t1 - time0).count();
-    LOG("Built %d tiles in %.0fs", int(stats.tilesbuilt.load()), dt);
+    LOG("Built %d tiles (%lu features) in %.0fs (%lu empty tiles skipped; %d DB commits, max %d tiles per commit)",
+        int(stats.tilesbuilt.load()), TileBuilder::totalFeats.load(), dt, stats.emptytiles.load(),
+        int(dbWriter.commits.load()), int(dbWriter.maxBatch.load()));
     return 0;
   }
 
+  std::mutex buildMutex;
+  std::map< TileID, std::shared_future<TileBlob> > buildQueue;
+  // low zoom tiles take 5-10x longer to build, so limit them to half of workers
+  BuildScheduler buildWorkers(numBuildThreads, numBuildThreads/2);
+
+  // pre-built tiles (--export); takes precedence over DB, so should be exported again after rebuilding tiles
+  std::unique_ptr<TileArchive> archive;
+  if(archivePath) {
+    archive = std::make_unique<TileArchive>();
+    if(!archive->open(archivePath)) {
+      LOG("Error opening tile archive %s", archivePath);
+      return -1;
+    }
+  }
+
   httplib::Server svr;  //httplib::SSLServer svr;
+  // httplib ties up a thread for each open connection, so idle keep-alive connections are closed quickly
+  svr.new_task_queue = [&](){ return new httplib::ThreadPool(numHttpThreads); };
+  svr.set_keep_alive_max_count(keepAliveMax);
+  svr.set_keep_alive_timeout(keepAliveSecs);
+  std::atomic_int buildWaiters = 0;  // requests blocked waiting for a build
+  TileCache tileCache(size_t(cacheMB) << 20);
+  TileCache zstdCache(zstdComp ? size_t(cacheMB) << 20 : 0);
+  SearchCache searchCache(size_t(searchCacheMB) << 20, searchCacheTTL);
+
+  // transcode gzip tile to zstd, saving result to cache and DB; returns null on failure
+  auto toZstd = [&](TileID id, const TileBlob& gz){
+    std::string raw, zs;
+    if(!gz->empty() && (!TileCompressor::gzip()->decompress(*gz, raw) || !zstdComp->compress(raw, zs, zstdLevels[id.z]))) {
+      LOG("Error converting tile %s to zstd", id.toString().c_str());
+      return TileBlob();
+    }
+    auto blob = std::make_shared<const std::string>(std::move(zs));
+    zstdCache.put(id, blob);
+    dbWriter.push(id, blob, {}, gz);
+    return blob;
+  };
+
+  // background builds not requested by a client (stale, prefetch, warm): saved to DB (and to cache if
+  //  cacheTile) when done; returns false if tile is already queued
+  // - prefetched and warmed tiles are tracked (up to MAX_TRACKED) so later requests for them can be counted
+  static constexpr size_t MAX_TRACKED = 1 << 18;
+  std::mutex trackedMutex;
+  std::unordered_set<TileID> trackedIds;
+  auto enqueueBackground = [&](TileID id, bool cacheTile, bool track){
+    std::lock_guard<std::mutex> buildLock(buildMutex);
+    if(buildQueue.count(id)) { return false; }  // already building or not yet saved
+    auto fut = buildWorkers.enqueue(id, BuildScheduler::BACKGROUND, [&, id, cacheTile](){
+      TileBlob blob = buildActive(id);
+      if(cacheTile) { tileCache.put(id, blob); }
+      zstdCache.erase(id);
+      dbWriter.push(id, blob, [&, id](){
+        std::lock_guard<std::mutex> lock(buildMutex);
+        buildQueue.erase(id);
+      });
+      return blob;
+    });
+    buildQueue.emplace(id, std::move(fut));
+    ++stats.tilesbuilt;
+    if(track) {
+      std::lock_guard<std::mutex> lock(trackedMutex);
+      if(trackedIds.size() < MAX_TRACKED) { trackedIds.insert(id); }
+    }
+    return true;
+  };
+
+  // prefetch: after building a tile for an interactive request, queue its uncached neighbors and children while
+  //  fewer than prefetchBudget background builds are waiting
+  auto prefetch = [&](TileID id){
+    if(buildWorkers.queued(BuildScheduler::BACKGROUND) >= size_t(prefetchBudget)) { return; }
+    std::vector<TileID> ids;
+    for(int dx = -1; dx <= 1; ++dx) {
+      for(int dy = -1; dy <= 1; ++dy) {
+        if(dx != 0 || dy != 0) { ids.emplace_back(id.x + dx, id.y + dy, id.z); }
+      }
+    }
+    if(id.z < maxZ) {
+      for(int ii = 0; ii < 4; ++ii) { ids.push_back(id.getChild(ii, maxZ)); }
+    }
+    for(TileID next : ids) {
+      if(!next.isValid() || tileCache.contains(next) || (archive && archive->contains(next)) || worldDB.hasTile(next)
+          || emptyTile(next)) { continue; }
+      if(enqueueBackground(next, true, true)) { ++stats.prefetched; }
+    }
+  };
+
+  // feeder for stale tiles (marked by --invalidate; old tile is served until new one is saved, which clears
+  //  stale flag) and --warm tiles, queued while fewer than rebuildStale (or, for warm tiles when no interactive
+  //  builds are waiting, number of build threads) background builds are waiting
+  std::mutex feederMutex;
+  std::condition_variable feederCv;
+  bool stopFeeder = false;
+  std::thread bgFeeder;
+  if(rebuildStale > 0 || !warmTiles.empty()) {
+    bgFeeder = std::thread([&](){
+      TileDB feederDB;
+      if(feederDB.open(worldDBPath, SQLITE_OPEN_READONLY) != SQLITE_OK) {
+        LOG("Error opening DB for background builds");
+        return;
+      }
+      feederDB.getStale = feederDB.stmt(getStaleSQL);
+      feederDB.hasTileStmt = feederDB.stmt(hasTileSQL);
+      size_t warmIdx = 0;
+      int warmx = -1, warmy = 0;  // next tile of warmTiles[warmIdx]
+      std::unique_lock<std::mutex> lock(feederMutex);
+      while(!feederCv.wait_for(lock, std::chrono::milliseconds(100), [&](){ return stopFeeder; })) {
+        size_t nbg = buildWorkers.queued(BuildScheduler::BACKGROUND);
+        if(rebuildStale > 0 && nbg < size_t(rebuildStale)) {
+          std::vector<TileID> ids;
+          feederDB.getStale.bind(rebuildStale).exec([&](int z, int x, int row){ ids.emplace_back(x, (1 << z) - 1 - row, z); });
+          for(TileID id : ids) {
+            if(enqueueBackground(id, true, false)) { ++stats.stalebuilt;  ++nbg; }
+          }
+        }
+        if(buildWorkers.queued(BuildScheduler::FOREGROUND) > 0) { continue; }
+        while(warmIdx < warmTiles.size() && nbg < size_t(numBuildThreads)) {
+          const WarmRange& r = warmTiles[warmIdx];
+          if(warmx < 0) { warmx = r.x0;  warmy = r.y0; }
+          TileID id(warmx, warmy, r.z);
+          if(++warmy > r.y1) { warmy = r.y0;  if(++warmx > r.x1) { warmx = -1;  ++warmIdx; } }
+          if((archive && archive->contains(id)) || feederDB.hasTile(id) || emptyTile(id)) { continue; }
+          if(enqueueBackground(id, false, true)) { ++stats.warmed;  ++nbg; }
+        }
+      }
+    });
+  }
 
   if(logStream.is_open()) {
     svr.set_logger([&](const httplib::Request& req, const httplib::Response& res){
@@ -225,10 +859,16 @@ Optional arguments:
     double dtcache = (stats.nscached.load()*1.E-6)/stats.reqscached.load();
     double dtbuilt = (stats.nsbuilt.load()*1.E-6)/(stats.reqsok.load() - stats.reqscached.load());
     double dtsearch = (stats.nssearch.load()*1.E-6)/stats.searchok.load();
+    double dtsearchcached = (stats.nssearchcached.load()*1.E-6)/stats.searchcached.load();
+    GolVersion::Ptr gol = GolVersion::active();
+    RingCache* ringCache = gol->ringCache.get();
+    LabelCache* labelCache = gol->labelCache.get();
+    LowZoomStore* lowZoomStore = gol->lowZoomStore.get();
     // std::format not available in g++12!
     const char* statfmt =
 R"(Uptime: %.0f s
 CPU: %.3f s/%.3f s
+GOL: version %d, %s, %s
 
 /v1:
   Avg response (cached): %.3f ms
@@ -237,23 +877,148 @@ CPU: %.3f s/%.3f s
   Reqs OK: %lu
   Offline tile reqs: %lu
   Tiles built: %lu
+  Stale tiles rebuilt: %lu
+  Prefetched/warmed tiles: %lu/%lu (%lu later requested)
+  Empty tiles (coverage): %lu
+  Archive tiles served: %lu of %lu
+  Tiles over budget: %lu
   Bytes out: %lu
+  Cache: %lu tiles, %.1f MB / %.0f MB
+  Cache hits: %lu
+  Cache misses: %lu
+  Cache evictions: %lu
+  DB commits: %lu
+  DB tiles written: %lu
+  DB last/max commit size: %lu/%lu tiles
+  DB write queue: %lu tiles
+  Build queue: %lu foreground, %lu background
+  Build promotions: %lu
+  Build waits: %d now, %lu rejected (overload), %lu timed out
+  Ring cache: %lu relations, %.1f MB
+  Ring cache hits/misses: %lu/%lu
+  Label cache: %lu labels, hits/misses: %lu/%lu
+  Low zoom store: %lu features, %lu points
 
 /search:
   Reqs: %lu
   Avg response: %.3f ms
+  Avg response (cached): %.3f ms
+  Cache: %lu results, %.1f MB
+  Cache hits/misses: %lu/%lu (%.1f%% hits, %lu from empty prefix)
 )";
-    auto statstr = fstring(statfmt, uptime, cpudt, dt, dtcache, dtbuilt, stats.reqs.load(),
-        stats.reqsok.load(), stats.ofltiles.load(), stats.tilesbuilt.load(), stats.bytesout.load(),
-        stats.searchok.load(), dtsearch);
+    auto statstr = fstring(statfmt, uptime, cpudt, dt, gol->version, gol->worldPath.c_str(), gol->oceanPath.c_str(), dtcache, dtbuilt, stats.reqs.load(),
+        stats.reqsok.load(), stats.ofltiles.load(), stats.tilesbuilt.load(), stats.stalebuilt.load(), stats.prefetched.load(),
+        stats.warmed.load(), stats.prefetchhits.load(), stats.emptytiles.load(),
+        stats.archivetiles.load(), archive ? archive->count() : 0, TileBuilder::overBudgetTiles.load(),
+        stats.bytesout.load(), tileCache.count(), tileCache.bytes()/1048576.0, tileCache.maxBytes()/1048576.0, tileCache.hits.load(),
+        tileCache.misses.load(), tileCache.evictions.load(), dbWriter.commits.load(),
+        dbWriter.tilesWritten.load(), dbWriter.lastBatch.load(), dbWriter.maxBatch.load(), dbWriter.queueDepth(),
+        buildWorkers.queued(BuildScheduler::FOREGROUND), buildWorkers.queued(BuildScheduler::BACKGROUND),
+        buildWorkers.promotions.load(), buildWaiters.load(), stats.reqsrejected.load(), stats.reqstimeout.load(),
+        ringCache ? ringCache->count() : 0, ringCache ? ringCache->bytes()/1048576.0 : 0.0,
+        ringCache ? ringCache->hits.load() : 0, ringCache ? ringCache->misses.load() : 0,
+        labelCache ? labelCache->count() : 0, labelCache ? labelCache->hits.load() : 0,
+        labelCache ? labelCache->misses.load() : 0,
+        lowZoomStore ? lowZoomStore->count() : 0, lowZoomStore ? lowZoomStore->points() : 0, stats.searchok.load(), dtsearch,
+        dtsearchcached, searchCache.count(), searchCache.bytes()/1048576.0, searchCache.hits.load(),
+        searchCache.misses.load(), 100.0*stats.searchcached.load()/stats.searchok.load(),
+        searchCache.prefixHits.load());
     res.set_content(statstr, "text/plain");
     return httplib::StatusCode::OK_200;
   });
 
+  // Prometheus metrics: per-stage tile build time histograms plus counters from /status
+  svr.Get("/metrics", [&](const httplib::Request& req, httplib::Response& res) {
+    std::string metrics = BuildStats::prometheus();
+    GolVersion::Ptr gol = GolVersion::active();
+    RingCache* ringCache = gol->ringCache.get();
+    LabelCache* labelCache = gol->labelCache.get();
+    LowZoomStore* lowZoomStore = gol->lowZoomStore.get();
+    auto counter = [&](const char* name, const char* help, uint64_t val){
+      metrics += fstring("# HELP %s %s\n# TYPE %s counter\n%s %lu\n", name, help, name, name, val);
+    };
+    auto gauge = [&](const char* name, const char* help, uint64_t val){
+      metrics += fstring("# HELP %s %s\n# TYPE %s gauge\n%s %lu\n", name, help, name, name, val);
+    };
+    counter("tile_requests_total", "Tile requests", stats.reqs.load());
+    counter("tile_requests_ok_total", "Tile requests served", stats.reqsok.load());
+    counter("tile_requests_cached_total", "Tile requests served from cache or DB", stats.reqscached.load());
+    counter("tiles_built_total", "Tiles built", stats.tilesbuilt.load());
+    counter("tiles_stale_rebuilt_total", "Stale tiles rebuilt in background", stats.stalebuilt.load());
+    counter("tiles_prefetched_total", "Tiles built by prefetch", stats.prefetched.load());
+    counter("tiles_warmed_total", "Tiles built by --warm", stats.warmed.load());
+    counter("tiles_prefetch_hits_total", "Requests for prefetched or warmed tiles", stats.prefetchhits.load());
+    counter("tiles_empty_total", "Empty ocean/land tiles served w/o build", stats.emptytiles.load());
+    counter("tiles_over_budget_total", "Tiles rebuilt w/ fewer features to fit --tile-budget-kb",
+        TileBuilder::overBudgetTiles.load());
+    counter("tiles_archive_total", "Tiles served from --archive", stats.archivetiles.load());
+    counter("tile_requests_rejected_total", "Tile requests rejected w/ 503 (too many waiting for builds)",
+        stats.reqsrejected.load());
+    counter("tile_requests_timeout_total", "Tile requests timed out w/ 504 waiting for build", stats.reqstimeout.load());
+    gauge("tile_build_waiters", "Tile requests waiting for builds", buildWaiters.load());
+    counter("tile_bytes_out_total", "Tile bytes served", stats.bytesout.load());
+    counter("tile_cache_hits_total", "In-memory tile cache hits", tileCache.hits.load());
+    counter("tile_cache_misses_total", "In-memory tile cache misses", tileCache.misses.load());
+    counter("tile_cache_evictions_total", "In-memory tile cache evictions", tileCache.evictions.load());
+    gauge("tile_cache_bytes", "In-memory tile cache size", tileCache.bytes());
+    counter("ring_cache_hits_total", "Assembled relation ring cache hits", ringCache ? ringCache->hits.load() : 0);
+    counter("ring_cache_misses_total", "Assembled relation ring cache misses", ringCache ? ringCache->misses.load() : 0);
+    gauge("ring_cache_bytes", "Assembled relation ring cache size", ringCache ? ringCache->bytes() : 0);
+    counter("label_cache_hits_total", "Area label position cache hits", labelCache ? labelCache->hits.load() : 0);
+    counter("label_cache_misses_total", "Area label position cache misses", labelCache ? labelCache->misses.load() : 0);
+    gauge("label_cache_entries", "Area label positions cached", labelCache ? labelCache->count() : 0);
+    gauge("lowzoom_store_features", "Features in low zoom store", lowZoomStore ? lowZoomStore->count() : 0);
+    gauge("gol_version", "GOL version (incremented by /admin/gol)", gol->version);
+    counter("tile_db_commits_total", "DB write transactions", dbWriter.commits.load());
+    gauge("tile_db_write_queue", "Tiles waiting to be written to DB", dbWriter.queueDepth());
+    gauge("tile_build_queue", "Tiles waiting to be built", buildWorkers.queued(BuildScheduler::FOREGROUND)
+        + buildWorkers.queued(BuildScheduler::BACKGROUND));
+    counter("search_requests_ok_total", "Search requests served", stats.searchok.load());
+    counter("search_requests_cached_total", "Search requests served from cache", stats.searchcached.load());
+    res.set_content(metrics, "text/plain; version=0.0.4");
+    return httplib::StatusCode::OK_200;
+  });
+
+  // swap GOL w/o restart: POST /admin/gol?world=<path>&ocean=<path> (paths default to current ones, e.g. for a
+  //  file replaced by rename) w/ X-Admin-Key; builds already running finish w/ old version
+  std::mutex swapMutex;
+  std::weak_ptr<GolVersion> retiredGol;
+  svr.Post("/admin/gol", [&](const httplib::Request& req, httplib::Response& res) {
+    if(adminKey.empty() || req.get_header_value("X-Admin-Key") != adminKey) { return httplib::StatusCode::Forbidden_403; }
+    std::unique_lock<std::mutex> lock(swapMutex, std::try_to_lock);
+    if(!lock.owns_lock()) {
+      res.set_content("GOL swap already in progress\n", "text/plain");
+      return httplib::StatusCode::Conflict_409;
+    }
+    // new version would reuse slot of previous one
+    if(!retiredGol.expired()) {
+      res.set_content("Previous GOL version still in use\n", "text/plain");
+      return httplib::StatusCode::ServiceUnavailable_503;
+    }
+    GolVersion::Ptr prev = GolVersion::active();
+    std::string worldPath = req.has_param("world") ? req.get_param_value("world") : prev->worldPath;
+    std::string oceanPath = req.has_param("ocean") ? req.get_param_value("ocean") : prev->oceanPath;
+    GolVersion::Ptr next;
+    try {
+      next = loadGol(worldPath.c_str(), oceanPath.c_str(), prev->version + 1);
+    }
+    catch(std::exception& e) {
+      LOG("Error loading GOL %s, %s: %s", worldPath.c_str(), oceanPath.c_str(), e.what());
+      res.set_content(fstring("Error loading GOL: %s\n", e.what()), "text/plain");
+      return httplib::StatusCode::InternalServerError_500;
+    }
+    GolVersion::setActive(next);
+    retiredGol = prev;
+    LOG("Swapped to GOL version %d (%s, %s)", next->version, worldPath.c_str(), oceanPath.c_str());
+    res.set_content(fstring("GOL version %d: %s, %s\n", next->version, worldPath.c_str(), oceanPath.c_str()), "text/plain");
+    return httplib::StatusCode::OK_200;
+  });
+
   svr.Get("/search", [&](const httplib::Request& req, httplib::Response& res) {
     auto t0req = std::chrono::steady_clock::now();
 
-    std::string json = ftsQuery(req.params, searchDBPath);
+    bool cached = false;
+    std::string json = ftsQuery(req.params, searchDBPath, searchCacheMB > 0 ? &searchCache : nullptr, &cached);
     if(json.empty()) { return httplib::StatusCode::InternalServerError_500; }
     res.set_content(std::move(json), "application/json");
 
@@ -261,6 +1026,10 @@ CPU: %.3f s/%.3f s
     auto dtreq = uint64_t(1E9*std::chrono::duration<double>(t1req - t0req).count());
     stats.nssearch += dtreq;
     ++stats.searchok;
+    if(cached) {
+      stats.nssearchcached += dtreq;
+      ++stats.searchcached;
+    }
 
     return httplib::StatusCode::OK_200;
   });
@@ -281,6 +1050,10 @@ CPU: %.3f s/%.3f s
       return httplib::StatusCode::BadRequest_400;
     }
     if(z > maxZ) { return httplib::StatusCode::NotFound_404; }
+    if(prefetchBudget > 0 || !warmTiles.empty()) {
+      std::lock_guard<std::mutex> lock(trackedMutex);
+      if(trackedIds.erase(id)) { ++stats.prefetchhits; }
+    }
 
     if(!worldDB.db) {
       if(worldDB.open(worldDBPath, SQLITE_OPEN_READONLY) != SQLITE_OK) {
@@ -288,70 +1061,109 @@ CPU: %.3f s/%.3f s
         return httplib::StatusCode::InternalServerError_500;
       }
       worldDB.getTile = worldDB.stmt(getTileSQL);
+      worldDB.getTileZstd = worldDB.stmt(getTileZstdSQL);
+      worldDB.hasTileStmt = worldDB.stmt(hasTileSQL);
     }
 
-    bool iscached = false;
+    // X-Tile-Priority: background for offline/prefetch requests, which are built after any interactive requests
+    auto priority = req.get_header_value("X-Tile-Priority") == "background" ?
+        BuildScheduler::BACKGROUND : BuildScheduler::FOREGROUND;
+    // client can set X-Hide-Encoding header to suppress Content-Encoding: gzip so client's network stack
+    //  doesn't unzip tile (only to have it recompressed when saving to client's mbtiles cache)
+    bool hideEncoding = req.get_header_value("X-Hide-Encoding") == "yes";
+    bool wantZstd = zstdComp && !hideEncoding && acceptsEncoding(req, "zstd");
+    bool iszstd = false;
+    TileBlob blob;
+    std::string_view archived;  // gzip tile in archive, served w/o copy
     // X-Rebuild-Tile header to force tile rebuild (w/ valid admin key)
-    if(!adminKey.empty() && req.has_header("X-Rebuild-Tile") && req.get_header_value("X-Admin-Key") == adminKey) {}
-    else {
-      worldDB.getTile.bind(id.z, id.x, id.yTMS()).exec([&](sqlite3_stmt* stmt){
-        const char* blob = (const char*) sqlite3_column_blob(stmt, 0);
-        const int length = sqlite3_column_bytes(stmt, 0);
-        res.set_content(blob, length, "application/vnd.mapbox-vector-tile");
-        ++stats.reqscached;
-        iscached = true;
-      });
+    if(!adminKey.empty() && req.has_header("X-Rebuild-Tile") && req.get_header_value("X-Admin-Key") == adminKey) {
+      tileCache.erase(id);
+      zstdCache.erase(id);
+    }
+    else if(wantZstd && (blob = zstdCache.get(id))) { iszstd = true; }
+    else if(wantZstd && (blob = worldDB.readTile(worldDB.getTileZstd, id))) {
+      zstdCache.put(id, blob);
+      iszstd = true;
+    }
+    else if(!(blob = tileCache.get(id))) {
+      // archive tiles aren't added to tileCache, since they are already in memory (page cache)
+      if(archive && archive->find(id, archived)) {
+        ++stats.archivetiles;
+        if(wantZstd) { blob = std::make_shared<const std::string>(archived); }  // transcoded below
+      }
+      else if((blob = worldDB.readTile(worldDB.getTile, id))) { tileCache.put(id, blob); }
+      else if((blob = emptyTile(id))) { ++stats.emptytiles; }  // not cached or saved, since cheap to check
+    }
+    bool iscached = blob || archived.data();
+    if(iscached) {
+      ++stats.reqscached;
     }
     // small chance that we could repeat tile build, but don't want to keep mutex locked during DB query
-    if(res.body.empty()) {
-      bool savetile = false;
-      std::shared_future<std::string> fut;
+    else {
+      bool newbuild = false;
+      std::shared_future<TileBlob> fut;
       {
         std::lock_guard<std::mutex> lock(buildMutex);
-        // check for pending build
+        // check for pending build; interactive request moves it ahead of background builds if not started
         auto it = buildQueue.find(id);
         if(it != buildQueue.end()) {
           fut = it->second;
+          if(priority == BuildScheduler::FOREGROUND) { buildWorkers.promote(id); }
         }
         else {
-          fut = buildWorkers.enqueue([&, id](){
-            return buildTile(worldGOL, oceanGOL, id);
+          // build thread caches and saves tile, even if empty (to prevent repeated build attempts and so Tangram
+          //  doesn't show z-1 proxy tile), so a build outlasting its requests (504) isn't wasted
+          fut = buildWorkers.enqueue(id, priority, [&, id](){
+            TileBlob blob = buildActive(id);
+            tileCache.put(id, blob);
+            dbWriter.push(id, blob, [&, id](){
+              std::lock_guard<std::mutex> lock(buildMutex);
+              buildQueue.erase(id);
+            });
+            return blob;
           });
           buildQueue.emplace(id, fut);
           ++stats.tilesbuilt;
-          savetile = true;
+          newbuild = true;
         }
       }
-      if(fut.wait_for(std::chrono::seconds(30)) != std::future_status::ready) {
-        return httplib::StatusCode::RequestTimeout_408;  // 504 would be more correct
+      // all requests for a tile wait on the same build; waiters are limited so cached tiles can still be served
+      if(fut.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        if(++buildWaiters > maxBuildWaiters) {
+          --buildWaiters;
+          ++stats.reqsrejected;
+          res.set_header("Retry-After", "1");
+          return httplib::StatusCode::ServiceUnavailable_503;
+        }
+        bool ready = fut.wait_for(std::chrono::seconds(buildTimeoutSecs)) == std::future_status::ready;
+        --buildWaiters;
+        if(!ready) {
+          ++stats.reqstimeout;
+          return httplib::StatusCode::GatewayTimeout_504;
+        }
       }
-      const std::string& mvt = fut.get();
-      // Return and save tile even if empty (to prevent repeated build attempts and so Tangram doesn't show
-      //  z-1 proxy tile
-      //if(mvt.empty()) { return httplib::StatusCode::NotFound_404; }
-      if(savetile) {
-        // note that capturing mvt by ref copies the ref (no such thing as ref to ref), so lifetime is
-        //  that of the shared_future holding the actual string (see C++20 standard 7.5.5.2 para. 13)
-        dbWriter.enqueue([&, id](){
-          worldDB.putTile.bind(id.z, id.x, id.yTMS());
-          sqlite3_bind_blob(worldDB.putTile.stmt, 4, mvt.data(), mvt.size(), SQLITE_STATIC);
-          if(!worldDB.putTile.exec())
-            LOG("Error adding tile %s to DB: %s", id.toString().c_str(), worldDB.errMsg());
-          { std::lock_guard<std::mutex> lock(buildMutex);  buildQueue.erase(id); }
-        });
+      blob = fut.get();
+      //if(blob->empty()) { return httplib::StatusCode::NotFound_404; }
+      if(newbuild && prefetchBudget > 0 && priority == BuildScheduler::FOREGROUND) { prefetch(id); }
+    }
+    if(wantZstd && !iszstd) {
+      if(TileBlob zs = toZstd(id, blob)) {
+        blob = std::move(zs);
+        iszstd = true;
       }
-      res.set_content(mvt.data(), mvt.size(), "application/vnd.mapbox-vector-tile");
     }
+    size_t nbytes = blob ? blob->size() : archived.size();
+    if(blob) { setTileContent(res, *blob, blob); }
+    else { setTileContent(res, archived, archive.get()); }
 
     LOGD("Serving %s\n", req.path.c_str());
     ++stats.reqsok;
-    stats.bytesout += res.body.size();
-    // client can set X-Hide-Encoding header to suppress Content-Encoding: gzip so client's network stack
-    //  doesn't unzip tile (only to have it recompressed when saving to client's mbtiles cache)
-    if(req.get_header_value("X-Hide-Encoding") != "yes") {
-      res.set_header("Content-Encoding", "gzip");
+    stats.bytesout += nbytes;
+    if(!hideEncoding) {
+      res.set_header("Content-Encoding", iszstd ? "zstd" : "gzip");
     }
-    if(req.get_header_value("X-Tile-Priority") == "background") { ++stats.ofltiles; }
+    if(zstdComp) { res.set_header("Vary", "Accept-Encoding"); }
+    if(priority == BuildScheduler::BACKGROUND) { ++stats.ofltiles; }
 
     // response time stats
     auto t1req = std::chrono::steady_clock::now();
@@ -363,8 +1175,13 @@ CPU: %.3f s/%.3f s
   });
 
   onSigInt = [&](){ svr.stop(); buildWorkers.requestStop(true); };
-  LOG("Server listening on port %d with %d tile threads", tcpPort, numBuildThreads);
+  LOG("Server listening on port %d with %d tile threads, %d HTTP threads", tcpPort, numBuildThreads, numHttpThreads);
   svr.listen("0.0.0.0", tcpPort);
+  if(bgFeeder.joinable()) {
+    { std::lock_guard<std::mutex> lock(feederMutex);  stopFeeder = true; }
+    feederCv.notify_all();
+    bgFeeder.join();
+  }
   LOG("Exiting main()");
   return 0;
 }
@@ -90,6 +90,16 @@ struct TileID {
 
 static const TileID NOT_A_TILE(-1, -1, -1, -1);
 
+namespace std {
+    template <>
+    struct hash<TileID> {
+        size_t operator()(const TileID& k) const {
+            uint64_t h = uint64_t(uint8_t(k.z)) << 56 | uint64_t(uint8_t(k.s)) << 48;
+            return std::hash<uint64_t>()(h ^ (uint64_t(uint32_t(k.x)) << 24) ^ uint32_t(k.y));
+        }
+    };
+}
+
 // cut and paste from Tangram ES types.h
 
 struct LngLat {
@@ -1,12 +1,15 @@
 #include "tilebuilder.h"
+#include "lowzoom.h"
+#include "coverage.h"
 #include "polylabel.hpp"
+#include <vtzero/vector_tile.hpp>
+#include <bit>
+#include <unordered_set>
+#include <utility>
 #include <geom/polygon/RingCoordinateIterator.h>
 #include <geom/polygon/RingBuilder.h>
 #include <geom/polygon/Segment.h>
 
-#define MINIZ_GZ_IMPLEMENTATION
-#include "miniz/miniz_gzip.h"
-
 // TileBuilder
 // Refs:
 // - https://github.com/mapbox/vector-tile-spec
@@ -16,18 +19,88 @@
 
 using namespace geodesk;
 
-Features* TileBuilder::worldFeats = nullptr;
+std::atomic_uint_fast64_t TileBuilder::totalFeats = 0;
+CompressLevels TileBuilder::gzipLevels(5);  // level = 5 gives nearly same size as 6 (w/ miniz) but significantly faster
+size_t TileBuilder::maxTileBytes = 0;
+std::atomic_uint_fast64_t TileBuilder::overBudgetTiles = 0;
+
+// TileScratch
+
+void TileScratch::recycle(vt_multi_polygon& mpoly)
+{
+  for(vt_polygon& poly : mpoly) {
+    for(vt_linear_ring& ring : poly) { put(freeRings, ring); }
+    put(freePolys, poly);
+  }
+  mpoly.clear();
+}
+
+void TileScratch::recycle(vt_multi_line_string& lines)
+{
+  for(vt_line_string& line : lines) { put(freeLines, line); }
+  lines.clear();
+}
+
+void TileScratch::reset()
+{
+  auto oversized = [](const auto& v){ return v.capacity() > MAX_POINTS; };
+  // recycle first, so oversized lines from these are freed too
+  recycle(clipLines);
+  recycle(wayLines);
+  freeRings.erase(std::remove_if(freeRings.begin(), freeRings.end(), oversized), freeRings.end());
+  freeLines.erase(std::remove_if(freeLines.begin(), freeLines.end(), oversized), freeLines.end());
+  if(oversized(tilePts)) { std::vector<i32vec2>().swap(tilePts); }
+  if(oversized(keep)) { std::vector<int>().swap(keep); }
+  if(oversized(coordX)) { std::vector<int32_t>().swap(coordX);  std::vector<int32_t>().swap(coordY); }
+  if(oversized(clipRing)) { vt_linear_ring().swap(clipRing); }
+}
+
+// GolVersion
+
+GolVersion::GolVersion(const char* _worldPath, const char* _oceanPath, int _version)
+    : world(_worldPath), ocean(_oceanPath), worldPath(_worldPath), oceanPath(_oceanPath), version(_version) {}
+
+GolVersion::~GolVersion() {}  // here so LowZoomStore and OceanCoverage are complete
+
+GolVersion::Ptr GolVersion::setActive(Ptr v)
+{
+  std::lock_guard<std::mutex> lock(s_mutex);
+  s_activePtr = v.get();
+  return std::exchange(s_active, std::move(v));
+}
+
+// versions sharing a slot are never used at once, so key for current version can be read w/o lock
+CodedString GolKey::get()
+{
+  const GolVersion& gol = GolVersion::current();
+  int slot = gol.slot();
+  if(m_versions[slot].load(std::memory_order_acquire) != gol.version) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_versions[slot].load(std::memory_order_relaxed) != gol.version) {
+      m_keys[slot] = gol.world.key(m_str);
+      m_versions[slot].store(gol.version, std::memory_order_release);
+    }
+  }
+  return m_keys[slot];
+}
 
 CodedString TileBuilder::getCodedString(std::string_view s)
 {
-  return worldFeats->key(s);  //CodedString{s, worldFeats->store()->strings().getCode(s.data(), s.size())};
+  return GolVersion::current().world.key(s);
+}
+
+int TileBuilder::getStringCode(std::string_view s)
+{
+  return GolVersion::current().world.store()->strings().getCode(s.data(), s.size());
 }
 
 
 TileBuilder::TileBuilder(TileID _id, const std::vector<std::string>& layers) : m_id(_id)
 {
-  for(auto& l : layers)
-    m_layers.emplace(l, vtzero::layer_builder{m_tile, l, 2, uint32_t(tileExtent)});  // MVT v2
+  m_layerBuilds.reserve(layers.size());
+  for(auto& l : layers) {
+    m_layerBuilds.push_back(std::make_unique<LayerBuilder>(l, uint32_t(tileExtent)));
+  }
 
   double units = Mercator::MAP_WIDTH/MapProjection::EARTH_CIRCUMFERENCE_METERS;
   m_origin = units*MapProjection::tileSouthWestCorner(m_id);
@@ -55,8 +128,30 @@ void TileBuilder::setFeature(Feature& feat)
 {
   m_feat = &feat;
   m_area = NAN;
-  m_featMPoly.clear();
+  m_scratch.recycle(m_featMPoly);
   m_featId = feat.id();  // save id for debugging
+  m_featRank = 0;
+}
+
+void TileBuilder::recordStats(std::chrono::steady_clock::time_point time0)
+{
+  m_stageNs[STAGE_TOTAL] = std::chrono::nanoseconds(std::chrono::steady_clock::now() - time0).count();
+  BuildStats::record(m_id.z, m_stageNs);
+}
+
+// max zoom rank to keep when rebuilding tile of size bytes to fit maxTileBytes, or -1 if tile is within budget
+//  or no more features can be dropped; weights of kept ranks are scaled by budget/bytes (tippecanoe-style)
+int TileBuilder::budgetRank(size_t bytes) const
+{
+  if(maxTileBytes == 0 || bytes <= maxTileBytes) { return -1; }
+  uint64_t total = 0;
+  for(uint64_t w : m_rankWeight) { total += w; }
+  uint64_t keep = uint64_t(double(total)*maxTileBytes/bytes);
+  int rank = 0;
+  for(uint64_t sum = m_rankWeight[0]; rank + 1 < NUM_RANKS && sum + m_rankWeight[rank+1] <= keep; ) {
+    sum += m_rankWeight[++rank];
+  }
+  return rank < std::min(m_maxRank, int(m_id.z)) ? rank : -1;
 }
 
 std::string TileBuilder::build(const Features& world, const Features& ocean, bool compress)
@@ -69,65 +164,255 @@ std::string TileBuilder::build(const Features& world, const Features& ocean, boo
   m_tileFeats = &tileFeats;
   int nfeats = 0;
 
-  auto dispatchFeatures = [&](const Features& feats, bool isOcean = false){
-    for(Feature f : feats) {
-      setFeature(f);
-      if(isOcean) { m_featId = OCEAN_ID; }
-      processFeature();
-      ++nfeats;
+  // saved child geometry can't be used if features are limited by queries, since children were not
+  if(!m_queries.empty()) { m_geomIn.clear(); }
+  m_lowZoom = m_gol.lowZoomStore && !m_queries.empty();
+  m_geomInBoxes.clear();
+  for(const TileGeomStore* child : m_geomIn) { m_geomInBoxes.push_back(tileBox(child->id)); }
+
+  auto dispatchFeatures = [&](const auto& feats, bool isOcean = false){
+    // GOL query is done lazily while iterating, so query time is loop time minus processFeature() time
+    uint64_t loopNs = 0, processNs0 = m_stageNs[STAGE_PROCESS];
+    {
+      StageTimer timer(loopNs);
+      for(Feature f : feats) {
+        setFeature(f);
+        if(isOcean) { m_featId = OCEAN_ID; }
+        else if(m_geomOut) { m_geomOut->feats.push_back(f); }
+        StageTimer processTimer(m_stageNs[STAGE_PROCESS]);
+        processFeature();
+        ++nfeats;
+      }
     }
+    m_stageNs[STAGE_QUERY] += loopNs - (m_stageNs[STAGE_PROCESS] - processNs0);
   };
 
-  if(m_queries.empty())
+  if(!m_geomIn.empty()) {
+    // union of features processed by children replaces GOL query; feature order within each child is kept
+    std::unordered_set<uint64_t> seen;
+    std::vector<Feature> feats;
+    for(const TileGeomStore* child : m_geomIn) {
+      for(const Feature& f : child->feats) {
+        if(seen.insert(featKey(f)).second) { feats.push_back(f); }
+      }
+    }
+    dispatchFeatures(feats);
+  }
+  else if(m_queries.empty())
     dispatchFeatures(tileFeats);
   else {
     for(const std::string& q : m_queries) {
-      dispatchFeatures(tileFeats(q.c_str()));
+      if(m_lowZoom) {
+        std::vector<Feature> feats;
+        {
+          StageTimer timer(m_stageNs[STAGE_QUERY]);
+          m_gol.lowZoomStore->find(q, m_tileBox, m_id.z, feats);
+        }
+        dispatchFeatures(feats);
+      }
+      else
+        dispatchFeatures(tileFeats(q.c_str()));
     }
   }
 
   // ocean polygons
   m_feat = nullptr;
   m_featId = OCEAN_ID;
+  m_featRank = 0;
   if(m_id.z < 8)
     dispatchFeatures(ocean(m_tileBox), true);
-  else if(!m_coastline.empty())
+  else if(!m_coastline.empty()) {
+    StageTimer processTimer(m_stageNs[STAGE_PROCESS]);
     processFeature();
+  }
   else {
-    LngLat center = MapProjection::projectedMetersToLngLat(MapProjection::tileCenter(m_id));
-    // create all ocean tile if center is inside an ocean polygon
-    // looks like there might be a bug in FeatureUtils::isEmpty() used by bool(Features), so do this instead
-    Features f = ocean.containingLonLat(center.longitude, center.latitude);
-    if(f.begin() != f.end()) { processFeature(); }
+    // create all ocean tile if coverage bitmap says so or, for mixed tiles, center is inside an ocean polygon
+    OceanCoverage::Cover cover = m_gol.coverage ? m_gol.coverage->get(m_id) : OceanCoverage::MIXED;
+    bool isOcean = cover == OceanCoverage::OCEAN;
+    if(cover == OceanCoverage::MIXED) {
+      LngLat center = MapProjection::projectedMetersToLngLat(MapProjection::tileCenter(m_id));
+      // looks like there might be a bug in FeatureUtils::isEmpty() used by bool(Features), so do this instead
+      Features f = ocean.containingLonLat(center.longitude, center.latitude);
+      isOcean = f.begin() != f.end();
+    }
+    if(isOcean) {
+      StageTimer processTimer(m_stageNs[STAGE_PROCESS]);
+      processFeature();
+    }
   }
 
-  Layer("");  // flush final feature
+  Layer(-1);  // flush final feature
+  totalFeats += nfeats;
   m_tileFeats = nullptr;
+  m_scratch.recycle(m_featMPoly);
+  m_scratch.reset();
 
-  std::string mvt = m_tile.serialize();  // very fast, not worth separate timing
-  if(mvt.size() == 0) {
+  // serialize one layer at a time (very fast), freeing each layer's builder once done, so that we never have
+  //  two complete uncompressed copies of tile
+  static thread_local std::string layerBuf;
+  TileCompressor* gz = TileCompressor::gzip();
+  auto time1 = std::chrono::steady_clock::now();
+  std::string mvt;
+  int origsize = 0;
+  if(compress) { gz->begin(gzipLevels[m_id.z]); }
+  for(auto& lb : m_layerBuilds) {
+    layerBuf.clear();
+    {
+      StageTimer timer(m_stageNs[STAGE_ENCODE]);
+      lb->tile.serialize(layerBuf);
+      bool merge = lb->merge;
+      lb.reset();
+      if(merge) { m_mergedFeats += mergeFeatures(layerBuf); }
+    }
+    origsize += layerBuf.size();
+    StageTimer timer(m_stageNs[STAGE_GZIP]);
+    if(compress) { gz->add(layerBuf); }
+    else { mvt.append(layerBuf); }
+  }
+  m_layerBuilds.clear();
+  if(origsize == 0) {
     LOG("No features for tile %s", m_id.toString().c_str());
+    recordStats(time0);
     return "";
   }
-  auto time1 = std::chrono::steady_clock::now();
-  int origsize = mvt.size();
+  bool ok = true;
   if(compress) {
-    std::stringstream in_strm(mvt);
-    std::stringstream out_strm;
-    gzip(in_strm, out_strm, 5);  // level = 5 gives nearly same size as 6 but significantly faster
-    mvt = std::move(out_strm).str();  // C++20
+    StageTimer timer(m_stageNs[STAGE_GZIP]);
+    ok = gz->finish(mvt);
+  }
+  if(!ok) {
+    LOG("Error compressing tile %s", m_id.toString().c_str());
+    recordStats(time0);
+    return "";
   }
   auto time2 = std::chrono::steady_clock::now();
+  recordStats(time0);
 
   double dt01 = std::chrono::duration<double>(time1 - time0).count()*1000;
   double dt12 = std::chrono::duration<double>(time2 - time1).count()*1000;
   double dt02 = std::chrono::duration<double>(time2 - time0).count()*1000;
-  LOG("Tile %s (%d bytes) built in %.1f ms (%.1f ms process %d/%d features w/ %d points, %.1f ms gzip %d bytes)",
-      m_id.toString().c_str(), int(mvt.size()), dt02, dt01, m_builtFeats, nfeats, m_builtPts, dt12, origsize);
+  LOG("Tile %s (%d bytes) built in %.1f ms (%.1f ms process %d/%d features w/ %d points, %d merged, %.1f ms gzip %d bytes)",
+      m_id.toString().c_str(), int(mvt.size()), dt02, dt01, m_builtFeats, nfeats, m_builtPts, m_mergedFeats, dt12, origsize);
 
   return mvt;
 }
 
+// merging features
+
+// serialized MVT w/ single layer is replaced by one in which features w/ identical properties are combined:
+//  for linestrings, lines w/ matching endpoints are joined and the rest added to a single multi-linestring;
+//  for polygons, all polygons are added to a single multi-polygon (note that a group keeps position of its
+//  first feature in layer, so draw order changes for later features); returns number of features removed
+// - properties are compared by key and value indices, since layer_builder dedups keys and values
+int TileBuilder::mergeFeatures(std::string& layerBuf)
+{
+  vtzero::vector_tile tile(layerBuf);
+  vtzero::layer layer = tile.next_layer();
+  if(!layer || layer.num_features() < 2) { return 0; }
+
+  struct Group { vtzero::GeomType type; std::vector<vtzero::feature> feats; };
+  std::vector<Group> groups;
+  std::unordered_map<std::string, size_t> groupIdx;
+  std::vector< std::pair<uint32_t, uint32_t> > props;
+  std::string groupKey;
+  size_t nfeats = 0;
+  while(auto feat = layer.next_feature()) {
+    ++nfeats;
+    vtzero::GeomType type = feat.geometry_type();
+    if(type != vtzero::GeomType::LINESTRING && type != vtzero::GeomType::POLYGON) {
+      groups.push_back({type, {feat}});  // points (and unknown) are not merged
+      continue;
+    }
+    props.clear();
+    feat.for_each_property_indexes([&](vtzero::index_value_pair&& kv){
+      props.emplace_back(kv.key().value(), kv.value().value());
+      return true;
+    });
+    std::sort(props.begin(), props.end());  // property order doesn't matter
+    groupKey.assign(1, char(type));
+    groupKey.append((const char*)props.data(), props.size()*sizeof(props[0]));
+    auto ins = groupIdx.emplace(groupKey, groups.size());
+    if(ins.second) { groups.push_back({type, {feat}}); }
+    else { groups[ins.first->second].feats.push_back(feat); }
+  }
+  if(groups.size() == nfeats) { return 0; }  // nothing to merge
+
+  using Part = std::vector<i32vec2>;
+  struct LineHandler {
+    std::vector<Part>& parts;
+    void linestring_begin(uint32_t count) { parts.emplace_back().reserve(count); }
+    void linestring_point(const vtzero::point p) { parts.back().emplace_back(p.x, p.y); }
+    void linestring_end() {}
+  };
+  struct RingHandler {
+    std::vector<Part>& parts;
+    void ring_begin(uint32_t count) { parts.emplace_back().reserve(count); }
+    void ring_point(const vtzero::point p) { parts.back().emplace_back(p.x, p.y); }
+    void ring_end(vtzero::ring_type) {}
+  };
+
+  vtzero::tile_builder tileOut;
+  vtzero::layer_builder layerOut(tileOut, layer);
+  std::vector<Part> parts;
+  for(Group& g : groups) {
+    if(g.feats.size() == 1) {
+      layerOut.add_feature(g.feats[0]);
+      continue;
+    }
+    parts.clear();
+    if(g.type == vtzero::GeomType::POLYGON) {
+      for(auto& f : g.feats) { vtzero::decode_polygon_geometry(f.geometry(), RingHandler{parts}); }
+      vtzero::polygon_feature_builder build(layerOut);
+      for(const Part& ring : parts) { build.add_ring_from_container(ring); }
+      build.copy_properties(g.feats[0]);
+      build.commit();
+      continue;
+    }
+    for(auto& f : g.feats) { vtzero::decode_linestring_geometry(f.geometry(), LineHandler{parts}); }
+    // join lines end to start; lines are followed back to start of chain first so chain is joined in one pass
+    auto ptKey = [](i32vec2 p){ return uint64_t(uint32_t(p.x)) << 32 | uint32_t(p.y); };
+    std::unordered_multimap<uint64_t, size_t> starts, ends;
+    for(size_t ii = 0; ii < parts.size(); ++ii) {
+      if(parts[ii].size() < 2 || parts[ii].front() == parts[ii].back()) { continue; }  // skip closed lines
+      starts.emplace(ptKey(parts[ii].front()), ii);
+      ends.emplace(ptKey(parts[ii].back()), ii);
+    }
+    std::vector<bool> used(parts.size(), false);
+    auto findUnused = [&](std::unordered_multimap<uint64_t, size_t>& m, i32vec2 p, size_t self){
+      auto range = m.equal_range(ptKey(p));
+      for(auto it = range.first; it != range.second; ++it) {
+        if(!used[it->second] && it->second != self) { return it->second; }
+      }
+      return parts.size();
+    };
+    vtzero::linestring_feature_builder build(layerOut);
+    for(size_t ii = 0; ii < parts.size(); ++ii) {
+      if(used[ii]) { continue; }
+      size_t head = ii;
+      for(size_t steps = 0; steps < parts.size(); ++steps) {
+        size_t prev = findUnused(ends, parts[head].front(), head);
+        if(prev == parts.size() || prev == ii) { break; }
+        head = prev;
+      }
+      used[head] = true;
+      Part& line = parts[head];
+      for(;;) {
+        size_t next = findUnused(starts, line.back(), head);
+        if(next == parts.size()) { break; }
+        used[next] = true;
+        line.insert(line.end(), parts[next].begin() + 1, parts[next].end());
+      }
+      build.add_linestring_from_container(line);
+      if(head != ii) { --ii; }  // ii not yet used
+    }
+    build.copy_properties(g.feats[0]);
+    build.commit();
+  }
+  layerBuf.clear();
+  tileOut.serialize(layerBuf);
+  return nfeats - groups.size();
+}
+
 // simplification
 
 static real dist2(vt_point p) { return p.x*p.x + p.y*p.y; }
@@ -145,37 +430,45 @@ static real distToSegment2(vt_point start, vt_point end, vt_point pt)
   return dist2(proj - pt);
 }
 
+// Ramer-Douglas-Peucker w/ explicit stack of segments (reused for every call on thread) instead of recursion
 static void simplifyRDP(const std::vector<vt_point>& pts, std::vector<int>& keep, int start, int end, real thresh)
 {
-  real maxdist2 = 0;
-  int argmax = 0;
-  auto& p0 = pts[start];
-  auto& p1 = pts[end];
-  for(int ii = start + 1; ii < end; ++ii) {
-    real d2 = distToSegment2(p0, p1, pts[ii]);
-    if(d2 > maxdist2) {
-      maxdist2 = d2;
-      argmax = ii;
+  static thread_local std::vector< std::pair<int, int> > stack;
+  stack.clear();
+  stack.emplace_back(start, end);
+  while(!stack.empty()) {
+    auto [s, e] = stack.back();
+    stack.pop_back();
+    real maxdist2 = 0;
+    int argmax = 0;
+    auto& p0 = pts[s];
+    auto& p1 = pts[e];
+    for(int ii = s + 1; ii < e; ++ii) {
+      real d2 = distToSegment2(p0, p1, pts[ii]);
+      if(d2 > maxdist2) {
+        maxdist2 = d2;
+        argmax = ii;
+      }
     }
+    if(maxdist2 < thresh*thresh) { continue; }
+    keep[argmax] = 1;
+    stack.emplace_back(s, argmax);
+    stack.emplace_back(argmax, e);
   }
-  if(maxdist2 < thresh*thresh) { return; }
-  keep[argmax] = 1;
-  simplifyRDP(pts, keep, start, argmax, thresh);
-  simplifyRDP(pts, keep, argmax, end, thresh);
 }
 
-static std::vector<int> simplify(const std::vector<vt_point>& pts, real thresh)
+// empty keep means keep all points
+static void simplify(const std::vector<vt_point>& pts, real thresh, std::vector<int>& keep)
 {
-  if(thresh <= 0 || pts.size() < 3) { return {}; }
-  std::vector<int> keep(pts.size(), 0);
+  keep.clear();
+  if(thresh <= 0 || pts.size() < 3) { return; }
+  keep.assign(pts.size(), 0);
   keep.front() = 1;  keep.back() = 1;
+  // distance from segment to any point inside bbox is less than bbox diagonal, so all interior points removed
+  vt_point pmin = pts[0], pmax = pts[0];
+  for(const vt_point& p : pts) { pmin = min(pmin, p);  pmax = max(pmax, p); }
+  if(dist2(pmax - pmin) < thresh*thresh) { return; }
   simplifyRDP(pts, keep, 0, pts.size() - 1, thresh);
-  return keep;
-  //size_t dst = 0;
-  //for(size_t src = 0; src < pts.size(); ++src) {
-  //  if(keep[src]) { pts[dst++] = pts[src]; }
-  //}
-  //pts.resize(dst);
 }
 
 // from ulib/geom.cpp
@@ -206,19 +499,20 @@ vt_point TileBuilder::toTileCoord(Coordinate r) {
 }
 
 // in visvalingam.cpp
-std::vector<int> visvalingam(const std::vector<vt_point>& pts, real thresh);
+void visvalingam(const std::vector<vt_point>& pts, real thresh, std::vector<int>& keep);
 
 // simplify and write to TileBuilder.tilePts as MVT coord (i32 0..tileExtent)
 const std::vector<i32vec2>& TileBuilder::toTilePts(const std::vector<vt_point>& pts, const std::vector<int>& keep)
 {
-  m_tilePts.clear();
-  m_tilePts.reserve(pts.size());
+  std::vector<i32vec2>& tilePts = m_scratch.tilePts;
+  tilePts.clear();
+  tilePts.reserve(pts.size());
   for(size_t ii = 0; ii < pts.size(); ++ii) {
     if(!keep.empty() && !keep[ii]) { continue; }
     auto ip = i32vec2(pts[ii].x*tileExtent + 0.5f, (1 - pts[ii].y)*tileExtent + 0.5f);
-    if(m_tilePts.empty() || ip != m_tilePts.back()) { m_tilePts.push_back(ip); }
+    if(tilePts.empty() || ip != tilePts.back()) { tilePts.push_back(ip); }
   }
-  return m_tilePts;
+  return tilePts;
 }
 
 // clockwise distance along tile perimeter from 0,0 to point p
@@ -244,73 +538,89 @@ void TileBuilder::buildCoastline()
         : outers.emplace_back().emplace_back(std::move(ring));
   };
 
-  struct vt_point_order {
-    bool operator()(const vt_point& lhs, const vt_point& rhs) const {
-      return lhs.x < rhs.x || (lhs.x == rhs.x && lhs.y < rhs.y);
-    }
+  // open segments are joined end to start through a hash index of start points; each segment is moved once
+  //  into segs and joined segments are appended in place
+  auto pointKey = [](const vt_point& p){
+    float x = p.x + 0.0f, y = p.y + 0.0f;  // +0.0f so -0 == 0
+    return uint64_t(std::bit_cast<uint32_t>(x)) << 32 | std::bit_cast<uint32_t>(y);
   };
-  std::map<vt_point, vt_linear_ring, vt_point_order> segments;
-
+  std::vector<vt_linear_ring> segs;
+  std::unordered_map<uint64_t, uint32_t> segStarts;
+  segStarts.reserve(m_coastline.size());
   for(auto& way : m_coastline) {
     if(way.back() == way.front())
       add_ring(std::move(way));
-    else
-      segments.emplace(way.front(), std::move(way));
+    else if(segStarts.emplace(pointKey(way.front()), uint32_t(segs.size())).second)
+      segs.emplace_back(std::move(way));
   }
 
-  for(auto ii = segments.begin(); ii != segments.end();) {
-    vt_linear_ring& ring = ii->second;
-    auto jj = segments.find(ring.back());
-    if(jj == segments.end()) { ++ii; }
-    else if(jj == ii) {
-      add_ring(std::move(ring));
-      ii = segments.erase(ii);
-    }
-    else {
-      ring.insert(ring.end(), jj->second.begin(), jj->second.end());
-      segments.erase(jj);
-      // don't advance ii to repeat w/ new ring.back()
+  std::vector<bool> joined(segs.size(), false);
+  for(uint32_t ii = 0; ii < segs.size(); ++ii) {
+    vt_linear_ring& ring = segs[ii];
+    while(!joined[ii]) {
+      auto jj = segStarts.find(pointKey(ring.back()));
+      if(jj == segStarts.end()) { break; }
+      uint32_t next = jj->second;
+      segStarts.erase(jj);
+      joined[next] = true;
+      if(next == ii) { add_ring(std::move(ring)); }
+      else {
+        ring.insert(ring.end(), segs[next].begin(), segs[next].end());
+        vt_linear_ring().swap(segs[next]);
+        // repeat w/ new ring.back()
+      }
     }
   }
 
   // for remaining segments, we must add path from exit (end) clockwise along tile edge to entry
-  //  (beginning) of next segment
-  std::map<real, vt_linear_ring> edgesegs;
-  for(auto& seg : segments) {
-    real d = perimDistCW(seg.second.front());
+  //  (beginning) of next segment; edgesegs is sorted by perimeter distance of entry
+  std::vector< std::pair<real, uint32_t> > edgesegs;
+  for(uint32_t ii = 0; ii < segs.size(); ++ii) {
+    if(joined[ii]) { continue; }
+    real d = perimDistCW(segs[ii].front());
     if(d < 0) {
       LOG("Invalid coastline segment for %s", m_id.toString().c_str());
       continue;  //return;
     }
-    edgesegs.emplace(d, std::move(seg.second));
+    edgesegs.emplace_back(d, ii);
   }
+  std::stable_sort(edgesegs.begin(), edgesegs.end(),
+      [](const auto& a, const auto& b){ return a.first < b.first; });
+  // segments entering at the same point are degenerate; keep only the first
+  edgesegs.erase(std::unique(edgesegs.begin(), edgesegs.end(),
+      [](const auto& a, const auto& b){ return a.first == b.first; }), edgesegs.end());
 
   static vt_point corners[] = {{0,0}, {0,1}, {1,1}, {1,0}};
-  for(auto ii = edgesegs.begin(); ii != edgesegs.end();) {
-    vt_linear_ring& ring = ii->second;
+  for(size_t ii = 0; ii < edgesegs.size();) {
+    vt_linear_ring& ring = segs[edgesegs[ii].second];
     real dback = perimDistCW(ring.back());
     if(dback < 0) {
       LOG("Invalid coastline segment for %s", m_id.toString().c_str());
-      ii = edgesegs.erase(ii); continue;  //return;
+      edgesegs.erase(edgesegs.begin() + ii); continue;  //return;
     }
-    auto next = edgesegs.lower_bound(dback);
+    auto next = std::lower_bound(edgesegs.begin(), edgesegs.end(), dback,
+        [](const auto& e, real d){ return e.first < d; });
     if(next == edgesegs.end()) { next = edgesegs.begin(); }
+    size_t nn = next - edgesegs.begin();
 
-    vt_point dest = next->second.front();
+    vt_linear_ring& nextring = segs[next->second];
+    vt_point dest = nextring.front();
     real dfront = next->first;  //perimDistCW(dest);
     if(dfront < dback) { dfront += 4; }
     int c = std::ceil(dback);
     while(c < dfront) {
       ring.push_back(corners[(c++)%4]);
     }
-    if(ii == next) {
+    if(nn == ii) {
       ring.push_back(dest);
       add_ring(std::move(ring));
-      ii = edgesegs.erase(ii);
+      edgesegs.erase(next);
     }
     else {
-      ring.insert(ring.end(), next->second.begin(), next->second.end());
+      ring.insert(ring.end(), nextring.begin(), nextring.end());
+      vt_linear_ring().swap(nextring);
       edgesegs.erase(next);
+      if(nn < ii) { --ii; }
       // don't advance ii to repeat w/ new ring.back()
     }
   }
@@ -346,41 +656,192 @@ void TileBuilder::buildCoastline()
 
 void TileBuilder::addCoastline(Feature& way)
 {
-  vt_multi_line_string clipPts = loadWayFeature(way);
+  // coastline segments are joined by exact endpoint match, so we can't use pieces saved by child tiles
+  vt_multi_line_string clipPts;
+  loadWayFeature(way, clipPts, false);
   m_coastline.insert(m_coastline.end(),
       std::make_move_iterator(clipPts.begin()), std::make_move_iterator(clipPts.end()));
 }
 
-vt_multi_line_string TileBuilder::loadWayFeature(Feature& way)
+// pyramid build
+
+uint64_t TileBuilder::featKey(const Feature& f)
 {
-  vt_multi_line_string clipPts;
-  vt_line_string& tempPts = clipPts.emplace_back();
-  WayCoordinateIterator iter(WayPtr(way.ptr()));
-  int n = iter.coordinatesRemaining();
-  tempPts.reserve(n);
-  vt_point pmin(REAL_MAX, REAL_MAX), pmax(-REAL_MAX, -REAL_MAX);
-  while(n-- > 0) {
-    vt_point p = toTileCoord(iter.next());
-    tempPts.push_back(p);
-    pmin = min(p, pmin);
-    pmax = max(p, pmax);
+  // node, way, and relation ids are independent
+  return uint64_t(f.id()) << 2 | (f.isNode() ? 0 : f.isWay() ? 1 : 2);
+}
+
+// convert from tile coords of child tile to tile coords of this tile
+template<class T>
+T TileBuilder::childToTile(TileID child, T p) const
+{
+  // tile coords have y up, while tile y index increases downward
+  return (p + T(child.x - 2*m_id.x, 1 - (child.y - 2*m_id.y)))/2;
+}
+
+// merge pieces of way saved by children; returns false if a child tile intersecting way didn't save it (e.g.
+//  because feature was rejected at child zoom), in which case way must be loaded from GOL
+bool TileBuilder::loadSavedLines(Feature& way, vt_multi_line_string& lines)
+{
+  uint64_t key = featKey(way);
+  for(size_t ii = 0; ii < m_geomIn.size(); ++ii) {
+    auto it = m_geomIn[ii]->lines.find(key);
+    if(it == m_geomIn[ii]->lines.end()) {
+      if(m_geomInBoxes[ii].intersects(way.bounds())) { m_scratch.recycle(lines); return false; }
+      continue;
+    }
+    for(const vt_line_string& src : it->second) {
+      if(src.empty()) { continue; }
+      vt_line_string& dest = lines.emplace_back(m_scratch.takeLine());
+      dest.reserve(src.size());
+      for(const vt_point& p : src) { dest.push_back(childToTile(m_geomIn[ii]->id, p)); }
+    }
+  }
+  if(lines.size() > 1) { joinLines(lines); }
+  return true;
+}
+
+// join pieces of a line split by edges between child tiles; clipped endpoints may differ by rounding error, so
+//  start points are indexed by grid cell (larger than the error) and each end point checks neighboring cells
+void TileBuilder::joinLines(vt_multi_line_string& lines)
+{
+  static constexpr real CELL = 1.0f/65536;
+  static constexpr real MAX_DIST2 = 1E-10f;
+  auto cellKey = [](int64_t cx, int64_t cy){ return uint64_t(uint32_t(cx)) << 32 | uint32_t(cy); };
+  size_t n = lines.size();
+  std::unordered_multimap<uint64_t, uint32_t> starts;
+  starts.reserve(n);
+  for(size_t ii = 0; ii < n; ++ii) {
+    vt_point p = lines[ii].front();
+    starts.emplace(cellKey(std::floor(p.x/CELL), std::floor(p.y/CELL)), uint32_t(ii));
+  }
+  // piece continuing each piece
+  std::vector<int32_t> next(n, -1);
+  std::vector<bool> hasPrev(n, false), used(n, false);
+  auto findNext = [&](size_t ii) -> int32_t {
+    vt_point p = lines[ii].back();
+    int64_t cx = std::floor(p.x/CELL), cy = std::floor(p.y/CELL);
+    for(int64_t dx = -1; dx <= 1; ++dx) {
+      for(int64_t dy = -1; dy <= 1; ++dy) {
+        auto range = starts.equal_range(cellKey(cx + dx, cy + dy));
+        for(auto it = range.first; it != range.second; ++it) {
+          uint32_t jj = it->second;
+          if(jj != ii && !hasPrev[jj] && dist2(p - lines[jj].front()) <= MAX_DIST2) { return jj; }
+        }
+      }
+    }
+    return -1;
+  };
+  for(size_t ii = 0; ii < n; ++ii) {
+    next[ii] = findNext(ii);
+    if(next[ii] >= 0) { hasPrev[next[ii]] = true; }
+  }
+
+  vt_multi_line_string joined;
+  auto follow = [&](size_t ii){
+    vt_line_string& dest = joined.emplace_back(std::move(lines[ii]));
+    used[ii] = true;
+    for(int32_t jj = next[ii]; jj >= 0 && !used[jj]; jj = next[jj]) {
+      dest.insert(dest.end(), lines[jj].begin() + 1, lines[jj].end());
+      used[jj] = true;
+    }
+  };
+  for(size_t ii = 0; ii < n; ++ii) {
+    if(!hasPrev[ii]) { follow(ii); }
+  }
+  // remaining pieces form closed chains
+  for(size_t ii = 0; ii < n; ++ii) {
+    if(!used[ii]) { follow(ii); }
+  }
+  m_scratch.recycle(lines);
+  lines.swap(joined);
+}
+
+// polygons saved by a child; returns false, so area must be loaded from GOL, if a child tile intersecting area
+//  didn't save it or if area has pieces in more than one child (pieces aren't dissolved along child edges)
+bool TileBuilder::loadSavedArea()
+{
+  uint64_t key = featKey(feature());
+  bool found = false;
+  int numChildren = 0;  // children w/ non-empty pieces
+  for(size_t ii = 0; ii < m_geomIn.size(); ++ii) {
+    TileID childId = m_geomIn[ii]->id;
+    auto it = m_geomIn[ii]->areas.find(key);
+    if(it == m_geomIn[ii]->areas.end()) {
+      if(m_geomInBoxes[ii].intersects(feature().bounds())) { m_scratch.recycle(m_featMPoly); return false; }
+      continue;
+    }
+    const TileGeomStore::AreaGeom& src = it->second;
+    if(!found) {
+      // area, centroid, and bounds are for the whole (unclipped) feature, so same for all children
+      m_area = src.area;
+      m_centroid = childToTile(childId, src.centroid);
+      m_polyMin = childToTile(childId, src.min);
+      m_polyMax = childToTile(childId, src.max);
+      found = true;
+    }
+    bool hasPieces = false;
+    for(const vt_polygon& poly : src.mpoly) {
+      if(poly.front().size() < 4) { continue; }
+      if(!hasPieces && ++numChildren > 1) { m_scratch.recycle(m_featMPoly); return false; }
+      hasPieces = true;
+      vt_polygon& dest = m_featMPoly.emplace_back(m_scratch.takePoly());
+      for(const vt_linear_ring& ring : poly) {
+        vt_linear_ring& destring = dest.emplace_back(m_scratch.takeRing());
+        destring.reserve(ring.size());
+        for(const vt_point& p : ring) { destring.push_back(childToTile(childId, p)); }
+      }
+    }
   }
+  return found;
+}
+
+void TileBuilder::loadWayFeature(Feature& way, vt_multi_line_string& clipPts, bool useSaved)
+{
+  m_scratch.recycle(clipPts);
+  if(!useSaved || m_geomIn.empty() || !loadSavedLines(way, clipPts)) { loadGolLines(way, clipPts); }
+  // saved for parent even if loaded from children, so every level of pyramid can use saved geometry
+  if(m_geomOut) { m_geomOut->lines.emplace(featKey(way), clipPts); }
+}
+
+void TileBuilder::loadGolLines(Feature& way, vt_multi_line_string& clipPts)
+{
+  vt_line_string& tempPts = clipPts.emplace_back(m_scratch.takeLine());
+  RingsPtr saved = m_lowZoom ? m_gol.lowZoomStore->geometry(way) : nullptr;
+  const int32_t* xs = saved ? saved->x.data() : m_scratch.coordX.data();
+  const int32_t* ys = saved ? saved->y.data() : m_scratch.coordY.data();
+  size_t n = saved ? saved->x.size() : 0;
+  if(!saved) {
+    WayCoordinateIterator iter(WayPtr(way.ptr()));
+    n = m_scratch.decode(iter);
+  }
+  tempPts.resize(n);
+  ProjectedBounds bounds = projectPoints(xs, ys, n, m_origin, m_scale, tempPts.data(), false);
   // see if we can skip clipping
-  if(pmin.x > 1 || pmin.y > 1 || pmax.x < 0 || pmax.y < 0) { clipPts.clear(); }
-  else if(pmin.x < 0 || pmin.y < 0 || pmax.x > 1 || pmax.y > 1) {
+  if(bounds.outside()) { m_scratch.recycle(clipPts); }
+  else if(!bounds.inside()) {
+    StageTimer timer(m_stageNs[STAGE_CLIP]);
     clipper<0> xclip{0,1};
     clipper<1> yclip{0,1};
-    clipPts = yclip(xclip(tempPts));
+    xclip(clipPts, m_scratch.clipLines);
+    m_scratch.recycle(clipPts);
+    yclip(m_scratch.clipLines, clipPts);
+    m_scratch.recycle(m_scratch.clipLines);
   }
-  return clipPts;
 }
 
 void TileBuilder::buildLine(Feature& way)
 {
-  vt_multi_line_string clipPts = loadWayFeature(way);
+  vt_multi_line_string& clipPts = m_scratch.wayLines;
+  loadWayFeature(way, clipPts);
   auto* build = static_cast<vtzero::linestring_feature_builder*>(m_build.get());
+  std::vector<int>& keep = m_scratch.keep;
   for(auto& line : clipPts) {
-    const auto& tilePts = toTilePts(line, simplify(line, simplifyThresh));
+    {
+      StageTimer timer(m_stageNs[STAGE_SIMPLIFY]);
+      simplify(line, simplifyThresh, keep);
+    }
+    const auto& tilePts = toTilePts(line, keep);
     if(tilePts.size() > 1) {
       m_hasGeom = true;
       m_builtPts += tilePts.size();
@@ -392,34 +853,31 @@ void TileBuilder::buildLine(Feature& way)
 template<class T>
 void TileBuilder::addRing(vt_polygon& poly, T&& iter, bool outer)
 {
-  int n = iter.coordinatesRemaining();
-  vt_linear_ring& ring = poly.emplace_back();
-  ring.reserve(n);
-  vt_point pmin(REAL_MAX, REAL_MAX), pmax(-REAL_MAX, -REAL_MAX);
-  while(n-- > 0) {
-    vt_point p = toTileCoord(iter.next());
-    ring.push_back(p);
-    pmin = min(p, pmin);
-    pmax = max(p, pmax);
-  }
-  // we want area and centroid of the whole feature, before clipping
-  double area = 0;
-  dvec2 centroid(0,0);
-  // we assume first and last points of ring are the same
-  for(size_t ii = 0; ii+1 < ring.size(); ++ii) {
-    double a = ring[ii].x * ring[ii+1].y - ring[ii+1].x * ring[ii].y;
-    area += a;
-    centroid += a * dvec2(ring[ii].x + ring[ii+1].x, ring[ii].y + ring[ii+1].y);
-  }
-
-  if(pmin.x > 1 || pmin.y > 1 || pmax.x < 0 || pmax.y < 0) { ring.clear(); }
-  else if(pmin.x < 0 || pmin.y < 0 || pmax.x > 1 || pmax.y > 1) {
+  size_t n = m_scratch.decode(iter);
+  addRing(poly, m_scratch.coordX.data(), m_scratch.coordY.data(), n, outer);
+}
+
+void TileBuilder::addRing(vt_polygon& poly, const int32_t* xs, const int32_t* ys, size_t n, bool outer)
+{
+  vt_linear_ring& ring = poly.emplace_back(m_scratch.takeRing());
+  ring.resize(n);
+  // we want area and centroid of the whole feature, before clipping; we assume first and last points of
+  //  ring are the same
+  ProjectedBounds bounds = projectPoints(xs, ys, n, m_origin, m_scale, ring.data(), true);
+  double area = bounds.area;
+  dvec2 centroid = bounds.centroid;
+
+  // clipping is skipped for rings entirely inside tile (most buildings at z14)
+  if(bounds.outside()) { ring.clear(); }
+  else if(!bounds.inside()) {
+    StageTimer timer(m_stageNs[STAGE_CLIP]);
     clipper<0> xclip{0,1};
     clipper<1> yclip{0,1};
-    ring = yclip(xclip(ring));
+    xclip(ring, m_scratch.clipRing);
+    yclip(m_scratch.clipRing, ring);
   }
-  m_polyMin = min(m_polyMin, pmin);
-  m_polyMax = max(m_polyMax, pmax);
+  m_polyMin = min(m_polyMin, bounds.min);
+  m_polyMax = max(m_polyMax, bounds.max);
 
   // note that sign of area will be reversed by y flip of tile coords
   bool rev = (area > 0) == outer;
@@ -429,6 +887,58 @@ void TileBuilder::addRing(vt_polygon& poly, T&& iter, bool outer)
   // wait until feature is accepted to simplify (which is a bit slow)
 }
 
+void TileBuilder::addRings(const AssembledRings& rings)
+{
+  vt_polygon* poly = nullptr;
+  for(const AssembledRings::Ring& r : rings.rings) {
+    if(r.outer) { poly = &m_featMPoly.emplace_back(m_scratch.takePoly()); }
+    addRing(*poly, &rings.x[r.start], &rings.y[r.start], r.size, r.outer);
+    if(!r.outer && poly->back().empty()) { poly->pop_back(); }
+  }
+}
+
+// way geometry in mercator coords as a single (outer) ring or line
+RingsPtr TileBuilder::wayRings(Feature& way)
+{
+  TileScratch& scratch = TileScratch::forThread();
+  WayCoordinateIterator iter(WayPtr(way.ptr()));
+  size_t n = scratch.decode(iter);
+  auto rings = std::make_shared<AssembledRings>();
+  rings->x.assign(scratch.coordX.begin(), scratch.coordX.begin() + n);
+  rings->y.assign(scratch.coordY.begin(), scratch.coordY.begin() + n);
+  rings->rings.push_back({0, uint32_t(n), true});
+  return rings;
+}
+
+// polygonize relation in mercator coords (independent of tile, so can be cached)
+RingsPtr TileBuilder::assembleRings(Feature& rel)
+{
+  TileScratch& scratch = TileScratch::forThread();
+  auto rings = std::make_shared<AssembledRings>();
+  auto addCoords = [&](const Polygonizer::Ring* ring, bool outer){
+    RingCoordinateIterator iter(ring);
+    size_t n = scratch.decode(iter);
+    rings->rings.push_back({uint32_t(rings->x.size()), uint32_t(n), outer});
+    rings->x.insert(rings->x.end(), scratch.coordX.begin(), scratch.coordX.begin() + n);
+    rings->y.insert(rings->y.end(), scratch.coordY.begin(), scratch.coordY.begin() + n);
+  };
+
+  Polygonizer polygonizer;
+  polygonizer.createRings(rel.store(), RelationPtr(rel.ptr()));
+  polygonizer.assignAndMergeHoles();
+  const Polygonizer::Ring* outer = polygonizer.outerRings();
+  while(outer) {
+    addCoords(outer, true);
+    const Polygonizer::Ring* inner = outer->firstInner();
+    while(inner) {
+      addCoords(inner, false);
+      inner = inner->next();
+    }
+    outer = outer->next();
+  }
+  return rings;
+}
+
 // Tangram mvt.cpp fixes the winding direction for outer ring from the first polygon in the tile, rather
 //  than using the MVT spec of positive signed area or using the winding of the first ring of each
 //  multipolygon; in any case, we should just follow the spec
@@ -436,33 +946,36 @@ void TileBuilder::addRing(vt_polygon& poly, T&& iter, bool outer)
 void TileBuilder::loadAreaFeature()
 {
   if(!std::isnan(m_area)) { return; }  // already loaded?
+  StageTimer timer(m_stageNs[STAGE_AREA]);
+  if(m_geomIn.empty() || !loadSavedArea()) { loadGolArea(); }
+  if(m_geomOut) {
+    m_geomOut->areas.emplace(featKey(feature()),
+        TileGeomStore::AreaGeom{m_featMPoly, m_area, m_centroid, m_polyMin, m_polyMax});
+  }
+}
 
+void TileBuilder::loadGolArea()
+{
   m_area = 0;
   m_centroid = {0,0};
   m_polyMin = vt_point(REAL_MAX, REAL_MAX);
   m_polyMax = vt_point(-REAL_MAX, -REAL_MAX);
-  if(feature().isWay()) {
-    vt_polygon& poly = m_featMPoly.emplace_back();
+  RingsPtr stored = m_lowZoom ? m_gol.lowZoomStore->geometry(feature()) : nullptr;
+  if(stored) { addRings(*stored); }
+  else if(feature().isWay()) {
+    vt_polygon& poly = m_featMPoly.emplace_back(m_scratch.takePoly());
     addRing(poly, WayCoordinateIterator(WayPtr(feature().ptr())), true);
     //if(poly.back().empty()) { m_featMPoly.pop_back(); }
   }
   else {
-    Polygonizer polygonizer;
-    polygonizer.createRings(feature().store(), RelationPtr(feature().ptr()));
-    polygonizer.assignAndMergeHoles();
-    const Polygonizer::Ring* outer = polygonizer.outerRings();
-    while(outer) {
-      vt_polygon& poly = m_featMPoly.emplace_back();
-      addRing(poly, RingCoordinateIterator(outer), true);
-      const Polygonizer::Ring* inner = outer->firstInner();
-      while(inner) {
-        addRing(poly, RingCoordinateIterator(inner), false);
-        if(poly.back().empty()) { poly.pop_back(); }
-        inner = inner->next();
-      }
-      //if(poly.front().empty()) { m_featMPoly.pop_back(); }  // remove whole polygon if outer empty
-      outer = outer->next();
+    RingCache* ringCache = m_gol.ringCache.get();
+    RingsPtr rings = ringCache ? ringCache->get(feature().id()) : nullptr;
+    if(!rings) {
+      rings = assembleRings(feature());
+      if(ringCache) { ringCache->put(feature().id(), rings); }
     }
+    addRings(*rings);
+    //if(poly.front().empty()) { m_featMPoly.pop_back(); }  // remove whole polygon if outer empty
   }
   // centroid in tile units
   m_centroid *= 1/(6*m_area);
@@ -485,7 +998,12 @@ void TileBuilder::buildPolygon(const vt_multi_polygon& mpoly)
     for(const vt_linear_ring& ring : poly) {
       // Visvalingam-Whyatt seems less likely to produce an invalid polygon vs. RDP ... but is slower so
       //  don't use for coastlines unless we see problems
-      auto keep = m_featId == OCEAN_ID ? simplify(ring, simplifyThresh) : visvalingam(ring, simplifyThresh*simplifyThresh);
+      std::vector<int>& keep = m_scratch.keep;
+      {
+        StageTimer timer(m_stageNs[STAGE_SIMPLIFY]);
+        if(m_featId == OCEAN_ID) { simplify(ring, simplifyThresh, keep); }
+        else { visvalingam(ring, simplifyThresh*simplifyThresh, keep); }
+      }
       const auto& tilePts = toTilePts(ring, keep);
       // tiny polygons get simplified to two points and discarded ... most should be rejected by
       //  SetMinZoomByArea() beforehand, but clipping can create some slivers
@@ -522,22 +1040,98 @@ Features TileBuilder::GetMembers()
   return m_tileFeats->membersOf(feature());
 }
 
-void TileBuilder::Layer(const std::string& layer, bool isClosed, bool _centroid)
+// true if ring (closed, w/o repeated points) turns the same way at every vertex
+static bool isConvex(const vt_linear_ring& ring)
+{
+  int sign = 0;
+  size_t n = ring.size() - 1;  // last point == first
+  for(size_t ii = 0; ii < n; ++ii) {
+    vt_point a = ring[ii], b = ring[(ii + 1) % n], c = ring[(ii + 2) % n];
+    real cross = (b.x - a.x)*(c.y - b.y) - (b.y - a.y)*(c.x - b.x);
+    if(cross == 0) { continue; }
+    if(sign == 0) { sign = cross > 0 ? 1 : -1; }
+    else if((cross > 0) != (sign > 0)) { return false; }
+  }
+  return sign != 0;
+}
+
+static vt_point ringCentroid(const vt_linear_ring& ring)
+{
+  double area = 0, cx = 0, cy = 0;
+  for(size_t ii = 0; ii + 1 < ring.size(); ++ii) {
+    const vt_point& a = ring[ii];
+    const vt_point& b = ring[ii + 1];
+    double cross = double(a.x)*b.y - double(b.x)*a.y;
+    area += cross;
+    cx += (a.x + b.x)*cross;
+    cy += (a.y + b.y)*cross;
+  }
+  return area != 0 ? vt_point(cx/(3*area), cy/(3*area)) : ring.front();
+}
+
+// label position for single polygon area feature w/ centroid in tile: polylabel of polygon clipped to z14 tile
+//  containing centroid, w/ 1/256 precision at z14, so position is the same at every zoom; (-1,-1) if none
+// - for z <= 14, result is kept in m_gol.labelCache (in mercator coords) and reused by other zooms; not for
+//  low zoom tiles, since label from generalized geometry could fall outside small or narrow polygons at z14
+// - a convex ring (w/o holes, e.g., most buildings) is labeled at its centroid w/o running polylabel
+vt_point TileBuilder::polyLabel(vt_point centroid)
+{
+  LabelCache* cache = m_id.z <= 14 && !m_lowZoom ? m_gol.labelCache.get() : nullptr;
+  uint64_t key = featKey(feature());
+  LabelCache::Label label;
+  if(cache && cache->get(key, label)) {
+    if(label.x == LabelCache::NO_LABEL.x) { return vt_point(-1, -1); }
+    return toTileCoord(Coordinate(label.x, label.y));
+  }
+
+  auto labelPoly = [](const vt_polygon& poly, real prec){
+    if(poly.size() == 1 && isConvex(poly.front())) { return ringCentroid(poly.front()); }
+    return mapbox::polylabel(poly, prec);
+  };
+  vt_point pl(-1, -1);
+  if(m_id.z >= 14) { pl = labelPoly(m_featMPoly[0], 1/256.0f); }
+  else {
+    // clip feature to z14 tile containing centroid
+    real zq = std::exp2(14 - m_id.z);
+    vt_point p14 = floor(centroid*zq);
+    vt_point min14 = p14/zq, max14 = (p14 + 1)/zq;
+    clipper<0> xclip{min14.x, max14.x};
+    clipper<1> yclip{min14.y, max14.y};
+    vt_polygon clipped;
+    clipped.reserve(m_featMPoly[0].size());
+    for(const vt_linear_ring& ring : m_featMPoly[0]) {
+      vt_linear_ring r = yclip(xclip(ring));
+      if(r.size() > 3 || clipped.empty()) { clipped.push_back(std::move(r)); }
+    }
+    // polygon already in tile coords; 1/256 precision for geometry in normalized tile coords, scaled to z14
+    if(clipped.front().size() > 3) { pl = labelPoly(clipped, 1/256.0f/zq); }
+  }
+  if(cache) {
+    dvec2 r = dvec2(pl.x, pl.y)/m_scale + m_origin;
+    bool ok = pl.x >= 0 && pl.y >= 0 && pl.x <= 1 && pl.y <= 1;
+    cache->put(key, ok ? LabelCache::Label{int32_t(std::lround(r.x)), int32_t(std::lround(r.y))} : LabelCache::NO_LABEL);
+  }
+  return pl;
+}
+
+void TileBuilder::Layer(int layer, bool isClosed, bool _centroid)
 {
   if(m_build && m_hasGeom) {
     ++m_builtFeats;
+    m_rankWeight[std::min(m_buildRank, NUM_RANKS - 1)] += m_builtPts - m_buildPts0 + 4;  // ~4 pts per feature header
     m_build->commit();
   }
   m_build.reset();  // have to commit/rollback before creating next builder
   m_hasGeom = false;
 
-  if(layer.empty()) { return; }  // layer == "" to flush last feature
-  auto it = m_layers.find(layer);
-  if(it == m_layers.end()) {
-    LOG("Layer not found: %s", layer.c_str());
+  if(layer < 0) { return; }  // layer < 0 to flush last feature
+  if(size_t(layer) >= m_layerBuilds.size()) {
+    LOG("Layer not found: %d", layer);
     return;
   }
-  vtzero::layer_builder& layerBuild = it->second;
+  vtzero::layer_builder& layerBuild = m_layerBuilds[layer]->layer;
+  m_buildRank = m_featRank;
+  m_buildPts0 = m_builtPts;
 
   // ocean
   if(!m_feat) {
@@ -552,23 +1146,8 @@ void TileBuilder::Layer(const std::string& layer, bool isClosed, bool _centroid)
       p = vt_point(m_centroid);
       // if centroid lies in this tile and only one polygon, use polylabel to get better label pos
       if(p.x >= 0 && p.y >= 0 && p.x <= 1 && p.y <= 1 && m_featMPoly.size() == 1 && m_featMPoly[0].front().size() > 3) {
-        vt_point pl(-1, -1);
-        if(m_id.z >= 14) { pl = mapbox::polylabel(m_featMPoly[0], 1/256.0f); }
-        else {
-          // clip feature to z14 tile containing centroid
-          real zq = std::exp2(14 - m_id.z);
-          vt_point p14 = floor(p*zq);
-          vt_point min14 = p14/zq, max14 = (p14 + 1)/zq;
-          clipper<0> xclip{min14.x, max14.x};
-          clipper<1> yclip{min14.y, max14.y};
-          vt_polygon clipped;
-          clipped.reserve(m_featMPoly[0].size());
-          for(const vt_linear_ring& ring : m_featMPoly[0]) { clipped.push_back(yclip(xclip(ring))); }
-          // polygon already in tile coords; 1/256 precision for geometry in normalized tile coords
-          // ... need to adjust precision to ensure same pos as z14 (but limit to 16x)
-          real prec = 1/256.0f/std::min(zq, real(16));
-          if(clipped.front().size() > 3) { pl = mapbox::polylabel(clipped, prec); }
-        }
+        StageTimer timer(m_stageNs[STAGE_POLYLABEL]);
+        vt_point pl = polyLabel(p);
         if(pl.x >= 0 && pl.y >= 0 && pl.x <= 1 && pl.y <= 1) { p = pl; }
         else {
           LOGD("rejecting polylabel %f,%f for %ld (centroid %f,%f)", pl.x, pl.y, feature().id(), p.x, p.y);
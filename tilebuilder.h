@@ -2,8 +2,18 @@
 
 #include <geodesk/geodesk.h>
 #include <vtzero/builder.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include "tileId.h"
 #include "clipper.h"
+#include "geomkernel.h"
+#include "compress.h"
+#include "buildstats.h"
+#include "ringcache.h"
+#include "labelcache.h"
 
 using geodesk::Feature;
 using geodesk::Features;
@@ -26,15 +36,155 @@ template<typename T> constexpr T squared(T x) { return x*x; }
 using CodedString = geodesk::Key;
 
 // can't think of a way to do this (w/o separate list of tag strings) w/o using macro
-#define Find(s) readTag( [](){ static CodedString cs = TileBuilder::getCodedString(s); return cs; }() )
+#define Find(s) readTag( [](){ static GolKey key(s); return key.get(); }() )
 #define Holds(s) bool(Find(s))
 
+// clipped, pre-simplification geometry (in tile coords) and list of processed features saved while building a
+//  tile so that parent can be built from its four children instead of querying GOL again (pyramid build)
+struct TileGeomStore
+{
+  struct AreaGeom { vt_multi_polygon mpoly; double area; dvec2 centroid; vt_point min, max; };
+
+  TileID id;
+  std::vector<Feature> feats;
+  std::unordered_map<uint64_t, vt_multi_line_string> lines;
+  std::unordered_map<uint64_t, AreaGeom> areas;
+
+  TileGeomStore(TileID _id) : id(_id) {}
+};
+
+// per-thread scratch state reused by all tiles built on a thread: buffers are cleared instead of freed, so
+//  once a worker has built a few tiles, temporary geometry, clipping, and simplification need no allocation
+// - rings and polygons of the current feature are returned to free lists by recycle() and handed out again
+//  (w/ their capacity) by take*(); reset() at end of build() frees oversized buffers so one huge feature
+//  doesn't pin memory for the life of the thread
+struct TileScratch
+{
+  static constexpr size_t MAX_FREE = 4096;  // max entries in each free list
+  static constexpr size_t MAX_POINTS = 1 << 16;  // larger buffers are freed by reset()
+
+  std::vector<int32_t> coordX, coordY;  // coords decoded from GOL, for projectPoints()
+  std::vector<i32vec2> tilePts;
+  std::vector<int> keep;
+  vt_linear_ring clipRing;  // output of first clipping pass
+  vt_multi_line_string clipLines;
+  vt_multi_line_string wayLines;  // for buildLine()
+  std::vector<vt_linear_ring> freeRings;
+  std::vector<vt_line_string> freeLines;
+  std::vector<vt_polygon> freePolys;
+
+  vt_linear_ring takeRing() { return take(freeRings); }
+  vt_line_string takeLine() { return take(freeLines); }
+  vt_polygon takePoly() { return take(freePolys); }
+  void recycle(vt_multi_polygon& mpoly);
+  void recycle(vt_multi_line_string& lines);
+  void reset();
+  template<class Iter> size_t decode(Iter& iter);
+
+  static TileScratch& forThread() { static thread_local TileScratch scratch; return scratch; }
+
+private:
+  template<class T> static T take(std::vector<T>& list) {
+    if(list.empty()) { return T(); }
+    T v = std::move(list.back());
+    list.pop_back();
+    return v;
+  }
+  template<class T> static void put(std::vector<T>& list, T& v) {
+    if(list.size() >= MAX_FREE || v.capacity() == 0) { return; }
+    v.clear();
+    list.push_back(std::move(v));
+  }
+};
+
+template<class Iter>
+size_t TileScratch::decode(Iter& iter)
+{
+  size_t n = iter.coordinatesRemaining();
+  coordX.resize(n);
+  coordY.resize(n);
+  for(size_t ii = 0; ii < n; ++ii) {
+    Coordinate c = iter.next();
+    coordX[ii] = c.x;
+    coordY[ii] = c.y;
+  }
+  return n;
+}
+
+class LowZoomStore;
+class OceanCoverage;
+
+// GOL files and the state derived from them, swapped as a unit when the server loads a new GOL; reference
+//  counted so tiles being built during a swap finish w/ the old version
+// - builds pin a version for the current thread w/ Scope; threads w/o a scope (e.g. batch builds, which
+//  never swap) use the active version
+// - keys and string codes resolved for a GOL (Find(), compileTagMatchers()) are kept per slot so two versions
+//  can be used at once; so a version can't be replaced until the one before it (same slot) is released
+class GolVersion
+{
+public:
+  using Ptr = std::shared_ptr<GolVersion>;
+  static constexpr int NUM_SLOTS = 2;
+
+  GolVersion(const char* worldPath, const char* oceanPath, int version);
+  ~GolVersion();
+  int slot() const { return version % NUM_SLOTS; }
+
+  Features world;
+  Features ocean;
+  const std::string worldPath, oceanPath;
+  const int version;
+  // all optional
+  std::unique_ptr<RingCache> ringCache;
+  std::unique_ptr<LabelCache> labelCache;
+  std::unique_ptr<LowZoomStore> lowZoomStore;  // used for tiles w/ queries (m_queries)
+  std::unique_ptr<OceanCoverage> coverage;  // classifies z >= 8 tiles w/o coastline as ocean or land
+
+  struct Scope {
+    Scope(Ptr v) : m_pin(std::move(v)), m_prev(t_current) { t_current = m_pin.get(); }
+    ~Scope() { t_current = m_prev; }
+    Ptr m_pin;
+    GolVersion* m_prev;
+  };
+
+  static const GolVersion& current() { return t_current ? *t_current : *s_activePtr.load(); }
+  static Ptr active() { std::lock_guard<std::mutex> lock(s_mutex);  return s_active; }
+  static Ptr setActive(Ptr v);  // returns previous active version
+
+private:
+  static inline thread_local GolVersion* t_current = nullptr;
+  static inline std::mutex s_mutex;
+  static inline Ptr s_active;
+  static inline std::atomic<GolVersion*> s_activePtr = nullptr;
+};
+
+// key for tag string, resolved once per GOL version, for Find()
+class GolKey
+{
+public:
+  GolKey(std::string_view s) : m_str(s) {}
+  CodedString get();
+
+private:
+  std::string m_str;
+  std::mutex m_mutex;
+  std::atomic_int m_versions[GolVersion::NUM_SLOTS] = {-1, -1};
+  CodedString m_keys[GolVersion::NUM_SLOTS];
+};
+
 class TileBuilder
 {
 public:
-  static Features* worldFeats;
   static CodedString getCodedString(std::string_view s);
+  static int getStringCode(std::string_view s);  // GOL global string code, or -1 if not a global string
+  static int globalStringCode(const TagValue& v) { return v.isGlobalString() ? v.stringCode() : -1; }
   static geodesk::Box tileBox(const TileID& id, double eps = 0.0);
+  static CompressLevels gzipLevels;
+  static std::atomic_uint_fast64_t totalFeats;  // features processed by all builders, for progress report
+  // tile size budget (output bytes; 0 for none): tiles over budget are rebuilt w/o lowest priority features
+  static size_t maxTileBytes;
+  static std::atomic_uint_fast64_t overBudgetTiles;
+  static constexpr int NUM_RANKS = BuildStats::NUM_ZOOMS;
 
   geodesk::Box m_tileBox;
   Features* m_tileFeats = nullptr;
@@ -59,18 +209,40 @@ public:
   // stats
   int m_builtPts = 0;
   int m_builtFeats = 0;
+  // feature priority is zoom rank: highest zoom passed to a successful MinZoom() (or implied by area), so
+  //  features shown only at higher zooms are dropped first; m_rankWeight is points (+ overhead) built per rank
+  int m_maxRank = INT_MAX;  // MinZoom(z) is false for z > m_maxRank, as if tile was at lower zoom
+  int m_featRank = 0, m_buildRank = 0, m_buildPts0 = 0;
+  uint64_t m_rankWeight[NUM_RANKS] = {};
   bool m_hasGeom = false;  // doesn't seem we can get this from vtzero
+  bool m_lowZoom = false;  // features and geometry from lowZoomStore
+  uint64_t m_stageNs[NUM_STAGES] = {};  // time spent in each stage for this tile
 
-  // temp containers
-  std::vector<i32vec2> m_tilePts;
+  // temp containers; builder must only be used on the thread that created it
+  TileScratch& m_scratch = TileScratch::forThread();
+  const GolVersion& m_gol = GolVersion::current();
 
   // coastline
   vt_multi_line_string m_coastline;
 
   TileID m_id;
-  vtzero::tile_builder m_tile;
-  std::map<std::string, vtzero::layer_builder> m_layers;
+  // each layer has its own tile_builder so tile can be serialized and compressed one layer at a time
+  struct LayerBuilder {
+    std::string name;
+    vtzero::tile_builder tile;
+    vtzero::layer_builder layer;
+    bool merge = false;  // merge features w/ identical attributes
+    LayerBuilder(const std::string& _name, uint32_t extent) : name(_name), layer(tile, _name, 2, extent) {}  // MVT v2
+  };
+  // in order passed to constructor; Layer() takes index into this (e.g., from an enum), so needs no lookup
+  std::vector< std::unique_ptr<LayerBuilder> > m_layerBuilds;
   std::vector<std::string> m_queries;
+  int m_mergedFeats = 0;
+
+  // pyramid build
+  TileGeomStore* m_geomOut = nullptr;
+  std::vector<const TileGeomStore*> m_geomIn;
+  std::vector<geodesk::Box> m_geomInBoxes;
 
   TileBuilder(TileID _id, const std::vector<std::string>& layers);
   Feature& feature() { return *m_feat; }
@@ -78,6 +250,9 @@ public:
   virtual void processFeature() {}
   std::string build(const Features& world, const Features& ocean, bool compress = true);
   void setFeature(Feature& feat);
+  void recordStats(std::chrono::steady_clock::time_point time0);
+  int mergeFeatures(std::string& layerBuf);
+  int budgetRank(size_t bytes) const;
 
   // reading geodesk feature
   TagValue readTag(CodedString cs) { return feature()[cs]; }
@@ -90,7 +265,14 @@ public:
   Features GetMembers();
 
   // writing tile feature
-  bool MinZoom(int z) { return m_id.z >= z; }
+  // for selecting features: records zoom rank, and is false for z > m_maxRank when tile is rebuilt to fit budget
+  bool MinZoom(int z) {
+    if(m_id.z < z || z > m_maxRank) { return false; }
+    m_featRank = std::max(m_featRank, z);
+    return true;
+  }
+  // for attributes or options of a feature already selected: doesn't change rank or depend on budget
+  bool ZoomAtLeast(int z) const { return m_id.z >= z; }
   void Attribute(const std::string& key, const TagValue& val) {
     if(val) { m_build->add_property(key, std::string(val)); }
   }
@@ -99,17 +281,30 @@ public:
   }
   template<class T>
   void AttributeNumeric(const std::string& key, T val) { m_build->add_property(key, val); }
-  void Layer(const std::string& layer, bool isClosed = false, bool _centroid = false);
-  void LayerAsCentroid(const std::string& layer) { Layer(layer, false, true); }
+  void Layer(int layer, bool isClosed = false, bool _centroid = false);  // layer < 0 to flush last feature
+  void LayerAsCentroid(int layer) { Layer(layer, false, true); }
 
 //private:
   void buildLine(Feature& way);
-  vt_multi_line_string loadWayFeature(Feature& way);
+  void loadWayFeature(Feature& way, vt_multi_line_string& clipPts, bool useSaved = true);
+  void loadGolLines(Feature& way, vt_multi_line_string& clipPts);
   void buildPolygon(const vt_multi_polygon& mpoly);
   template<class T> void addRing(vt_polygon& poly, T&& iter, bool outer);
+  void addRing(vt_polygon& poly, const int32_t* xs, const int32_t* ys, size_t n, bool outer);
+  void addRings(const AssembledRings& rings);
+  static RingsPtr assembleRings(Feature& rel);
+  static RingsPtr wayRings(Feature& way);
   void loadAreaFeature();
+  void loadGolArea();
+  vt_point polyLabel(vt_point centroid);
   const std::vector<i32vec2>& toTilePts(const std::vector<vt_point>& pts, const std::vector<int>& keep);
 
+  static uint64_t featKey(const Feature& f);
+  template<class T> T childToTile(TileID child, T p) const;
+  bool loadSavedLines(Feature& way, vt_multi_line_string& lines);
+  void joinLines(vt_multi_line_string& lines);
+  bool loadSavedArea();
+
   void addCoastline(Feature& way);
   void buildCoastline();
 };
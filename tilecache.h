@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "tileId.h"
+
+using TileBlob = std::shared_ptr<const std::string>;
+
+// in-memory LRU cache of tile blobs; blobs are reference counted so that responses can be served directly
+//  from cache w/o copying, and evicting a blob doesn't invalidate responses still being written
+// - split into shards, each w/ its own lock and LRU list, to limit contention between http threads
+class TileCache
+{
+public:
+  static constexpr size_t NUM_SHARDS = 16;
+
+  TileCache(size_t maxBytes) : m_maxBytes(maxBytes) {}
+  TileBlob get(TileID id);
+  bool contains(TileID id);  // doesn't count as hit or miss, or change LRU order
+  void put(TileID id, TileBlob blob);
+  void erase(TileID id);
+
+  size_t maxBytes() const { return m_maxBytes; }
+  size_t bytes() const { return m_bytes; }
+  size_t count() const { return m_count; }
+
+  std::atomic_uint_fast64_t hits = 0, misses = 0, evictions = 0;
+
+private:
+  using lru_t = std::list< std::pair<TileID, TileBlob> >;
+  struct Shard {
+    std::mutex mutex;
+    lru_t lru;  // most recently used first
+    std::unordered_map<TileID, lru_t::iterator> index;
+    size_t bytes = 0;
+  };
+
+  Shard m_shards[NUM_SHARDS];
+  std::atomic_size_t m_bytes = 0, m_count = 0;
+  const size_t m_maxBytes;
+
+  Shard& shard(TileID id) { return m_shards[std::hash<TileID>()(id) % NUM_SHARDS]; }
+  void remove(Shard& s, lru_t::iterator it);
+};
+
+inline TileBlob TileCache::get(TileID id)
+{
+  Shard& s = shard(id);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(id);
+  if(it == s.index.end()) { ++misses; return {}; }
+  s.lru.splice(s.lru.begin(), s.lru, it->second);
+  ++hits;
+  return it->second->second;
+}
+
+inline bool TileCache::contains(TileID id)
+{
+  Shard& s = shard(id);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  return s.index.count(id) > 0;
+}
+
+inline void TileCache::put(TileID id, TileBlob blob)
+{
+  const size_t shardBytes = m_maxBytes/NUM_SHARDS;
+  if(!blob || shardBytes == 0 || blob->size() > shardBytes) { return; }
+  Shard& s = shard(id);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(id);
+  if(it != s.index.end()) {
+    remove(s, it->second);
+    s.index.erase(it);
+  }
+  s.lru.emplace_front(id, std::move(blob));
+  s.index.emplace(id, s.lru.begin());
+  s.bytes += s.lru.front().second->size();
+  m_bytes += s.lru.front().second->size();
+  ++m_count;
+  while(s.bytes > shardBytes) {
+    s.index.erase(s.lru.back().first);
+    remove(s, std::prev(s.lru.end()));
+    ++evictions;
+  }
+}
+
+inline void TileCache::erase(TileID id)
+{
+  Shard& s = shard(id);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(id);
+  if(it == s.index.end()) { return; }
+  remove(s, it->second);
+  s.index.erase(it);
+}
+
+// caller must hold shard lock and remove entry from index
+inline void TileCache::remove(Shard& s, lru_t::iterator it)
+{
+  s.bytes -= it->second->size();
+  m_bytes -= it->second->size();
+  --m_count;
+  s.lru.erase(it);
+}
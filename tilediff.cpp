@@ -0,0 +1,148 @@
+#include "tilebuilder.h"
+#include "ulib.h"
+
+#define SQLITEPP_LOGE LOG
+#define SQLITEPP_LOGW LOG
+#include "sqlitepp.h"
+
+// incremental invalidation: features of old and new GOL are compared cell by cell, and every tile (z0 - maxZ)
+//  in mbtiles intersecting the old or new bounds of a changed feature is marked stale, to be rebuilt in the
+//  background (server --rebuild-stale) while the old tile is still served
+// - each feature is compared only in the cell containing the min corner of its bounds, so features spanning
+//  many cells are hashed once per GOL; a feature whose bounds move to another cell appears removed from one
+//  cell and added to the other, which marks the same tiles
+// - hash covers tags and node coords, way node coords, or relation member ids, so a moved node changes both
+//  the node (if a feature) and its parent ways
+
+static constexpr int DIFF_ZOOM = 8;  // cell size for comparison
+static constexpr uint32_t MAX_RANGE_TILES = 64;  // larger tile ranges are marked w/ a single range UPDATE
+
+static const char* markStaleSQL =
+    "UPDATE tiles SET stale = 1 WHERE zoom_level = ? AND tile_column = ? AND tile_row = ? AND stale = 0;";
+static const char* markStaleRangeSQL = "UPDATE tiles SET stale = 1 WHERE zoom_level = ?"
+    " AND tile_column BETWEEN ? AND ? AND tile_row BETWEEN ? AND ? AND stale = 0;";
+
+// tile index at zoom z of mercator coord; tile y index increases southward
+static uint32_t tileX(int32_t x, int z) { return z > 0 ? (uint32_t(x) ^ 0x80000000u) >> (32 - z) : 0; }
+static uint32_t tileY(int32_t y, int z) { return z > 0 ? (1u << z) - 1 - ((uint32_t(y) ^ 0x80000000u) >> (32 - z)) : 0; }
+
+static uint64_t featureHash(const Feature& f)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  auto mix = [&](uint64_t v){ h = (h ^ v) * 0x100000001b3ull; };  // FNV-1a on 64 bit words
+  for(auto tag : f.tags()) {
+    mix(std::hash<std::string_view>()(std::string_view(tag.key())));
+    mix(std::hash<std::string>()(std::string(tag.value())));
+  }
+  if(f.isNode()) {
+    Coordinate c = f.xy();
+    mix(uint64_t(uint32_t(c.x)) << 32 | uint32_t(c.y));
+  }
+  else if(f.isWay()) {
+    geodesk::WayCoordinateIterator iter(geodesk::WayPtr(f.ptr()));
+    for(int n = iter.coordinatesRemaining(); n > 0; --n) {
+      Coordinate c = iter.next();
+      mix(uint64_t(uint32_t(c.x)) << 32 | uint32_t(c.y));
+    }
+  }
+  else {
+    for(Feature m : f.members()) { mix(TileBuilder::featKey(m)); }
+  }
+  return h;
+}
+
+// hash of each feature w/ min corner of bounds in cell, by TileBuilder::featKey()
+struct CellFeature { uint64_t hash; geodesk::Box bounds; };
+using CellFeatures = std::unordered_map<uint64_t, CellFeature>;
+
+static CellFeatures cellFeatures(const Features& gol, TileID cell)
+{
+  CellFeatures feats;
+  // query w/ slightly expanded box, since cell assignment uses exact mercator coords
+  for(Feature f : gol(TileBuilder::tileBox(cell, -1/1024.0))) {
+    geodesk::Box b = f.bounds();
+    if(tileX(b.minX(), cell.z) != uint32_t(cell.x) || tileY(b.minY(), cell.z) != uint32_t(cell.y)) { continue; }
+    feats.emplace(TileBuilder::featKey(f), CellFeature{featureHash(f), b});
+  }
+  return feats;
+}
+
+int invalidateTiles(const Features& oldGOL, const Features& newGOL, const char* dbPath, int maxZ, int numThreads)
+{
+  SQLiteDB db;
+  if(db.open(dbPath, SQLITE_OPEN_READWRITE) != SQLITE_OK) {
+    LOG("Error opening %s", dbPath);
+    return -1;
+  }
+  auto t0 = std::chrono::steady_clock::now();
+  std::mutex changedMutex;
+  std::vector<geodesk::Box> changed;
+  std::atomic_size_t ncells = 0, nadded = 0, nremoved = 0, nmodified = 0;
+  {
+    WorkStealingPool diffWorkers(numThreads);
+    for(int x = 0; x < (1 << DIFF_ZOOM); ++x) {
+      for(int y = 0; y < (1 << DIFF_ZOOM); ++y) {
+        diffWorkers.post([&, cell = TileID(x, y, DIFF_ZOOM)](){
+          CellFeatures oldFeats = cellFeatures(oldGOL, cell);
+          CellFeatures newFeats = cellFeatures(newGOL, cell);
+          std::vector<geodesk::Box> bounds;
+          for(auto& [key, nf] : newFeats) {
+            auto it = oldFeats.find(key);
+            if(it == oldFeats.end()) { ++nadded;  bounds.push_back(nf.bounds); }
+            else if(it->second.hash != nf.hash) {
+              ++nmodified;
+              bounds.push_back(it->second.bounds);
+              bounds.push_back(nf.bounds);
+            }
+          }
+          for(auto& [key, of] : oldFeats) {
+            if(!newFeats.count(key)) { ++nremoved;  bounds.push_back(of.bounds); }
+          }
+          if(!bounds.empty()) {
+            std::lock_guard<std::mutex> lock(changedMutex);
+            changed.insert(changed.end(), bounds.begin(), bounds.end());
+          }
+          size_t n = ++ncells;
+          if(n % 4096 == 0) { LOG("Compared %d/%d cells", int(n), 1 << 2*DIFF_ZOOM); }
+        });
+      }
+    }
+    diffWorkers.waitForIdle();
+  }
+  double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  LOG("GOL diff in %.0f s: %d added, %d removed, %d modified features", dt,
+      int(nadded.load()), int(nremoved.load()), int(nmodified.load()));
+
+  // small ranges are split into tiles and deduplicated, since most changes touch a few z14 tiles
+  SQLiteStmt markStale = db.stmt(markStaleSQL);
+  SQLiteStmt markStaleRange = db.stmt(markStaleRangeSQL);
+  int nchanges0 = db.totalChanges();
+  db.exec("BEGIN;");
+  for(int z = 0; z <= maxZ; ++z) {
+    int nz0 = db.totalChanges();
+    std::unordered_set<uint64_t> tiles;
+    for(const geodesk::Box& b : changed) {
+      uint32_t x0 = tileX(b.minX(), z), x1 = tileX(b.maxX(), z), y0 = tileY(b.maxY(), z), y1 = tileY(b.minY(), z);
+      if(uint64_t(x1 - x0 + 1)*(y1 - y0 + 1) > MAX_RANGE_TILES) {
+        // tile_row is TMS y
+        int maxrow = (1 << z) - 1;
+        markStaleRange.bind(z, int(x0), int(x1), maxrow - int(y1), maxrow - int(y0)).exec();
+        continue;
+      }
+      for(uint32_t x = x0; x <= x1; ++x) {
+        for(uint32_t y = y0; y <= y1; ++y) { tiles.insert(uint64_t(x) << 32 | y); }
+      }
+    }
+    for(uint64_t t : tiles) {
+      TileID id(int(t >> 32), int(t & 0xFFFFFFFF), z);
+      markStale.bind(z, id.x, id.yTMS()).exec();
+    }
+    LOG("z%d: %d tiles marked stale", z, db.totalChanges() - nz0);
+  }
+  if(!db.exec("COMMIT;")) {
+    LOG("Error marking stale tiles in %s: %s", dbPath, db.errMsg());
+    return -1;
+  }
+  LOG("Marked %d tiles stale in %s", db.totalChanges() - nchanges0, dbPath);
+  return 0;
+}
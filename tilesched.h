@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "tileId.h"
+
+// thread pool for on-demand tile builds w/ priority lanes
+// - foreground (interactive) builds always run before background (offline/prefetch) builds
+// - low zoom builds (much slower) are limited to maxLowZoom workers so they can't starve high zoom requests
+// - a pending build can be promoted to foreground lane when an interactive request arrives for it
+class BuildScheduler
+{
+public:
+  enum Priority { FOREGROUND = 0, BACKGROUND, NUM_LANES };
+
+  BuildScheduler(size_t nthreads, size_t maxLowZoom, int lowZoomBelow = 10);
+  template<class F>
+  auto enqueue(TileID id, Priority pri, F&& f) -> std::future<typename std::invoke_result<F>::type>;
+  bool promote(TileID id);
+  void requestStop(bool clear = false);
+  size_t queued(Priority pri) { std::lock_guard<std::mutex> lock(m_mutex);  return m_lanes[pri].size(); }
+  ~BuildScheduler();
+
+  std::atomic_uint_fast64_t promotions = 0;
+
+private:
+  struct Task { TileID id; Priority pri; std::function<void()> fn; };
+  using lane_t = std::list<Task>;
+
+  bool isLowZoom(TileID id) const { return id.z < m_lowZoomBelow; }
+  bool nextTask(lane_t*& lane, lane_t::iterator& it);
+
+  std::vector<std::thread> m_workers;
+  lane_t m_lanes[NUM_LANES];
+  std::unordered_map<TileID, lane_t::iterator> m_pending;  // for promote()
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stop = false;
+  size_t m_lowZoomRunning = 0;
+  const size_t m_maxLowZoom;
+  const int m_lowZoomBelow;
+};
+
+inline BuildScheduler::BuildScheduler(size_t nthreads, size_t maxLowZoom, int lowZoomBelow)
+    : m_maxLowZoom(std::max(size_t(1), maxLowZoom)), m_lowZoomBelow(lowZoomBelow)
+{
+  if(nthreads == 0)
+    nthreads = std::thread::hardware_concurrency();
+  for(size_t ii = 0; ii < nthreads; ++ii) {
+    m_workers.emplace_back([this](){
+      for(;;) {
+        Task task{TileID(0, 0, 0), FOREGROUND, {}};
+        bool lowzoom;
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          lane_t* lane = nullptr;
+          lane_t::iterator it;
+          m_cv.wait(lock, [&](){ return nextTask(lane, it) || (m_stop && !lane); });
+          if(!lane) { return; }
+          auto pit = m_pending.find(it->id);
+          if(pit != m_pending.end() && pit->second == it) { m_pending.erase(pit); }
+          task = std::move(*it);
+          lane->erase(it);
+          lowzoom = isLowZoom(task.id);
+          if(lowzoom) { ++m_lowZoomRunning; }
+        }
+        task.fn();
+        if(lowzoom) {
+          { std::lock_guard<std::mutex> lock(m_mutex);  --m_lowZoomRunning; }
+          m_cv.notify_one();  // a waiting low zoom task may now be able to run
+        }
+      }
+    });
+  }
+}
+
+// find first runnable task in highest priority lane; sets lane to null if all lanes are empty
+inline bool BuildScheduler::nextTask(lane_t*& lane, lane_t::iterator& it)
+{
+  lane = nullptr;
+  bool lowZoomOK = m_lowZoomRunning < m_maxLowZoom;
+  for(lane_t& l : m_lanes) {
+    if(l.empty()) { continue; }
+    lane = &l;
+    for(it = l.begin(); it != l.end(); ++it) {
+      if(lowZoomOK || !isLowZoom(it->id)) { return true; }
+    }
+  }
+  return false;
+}
+
+template<class F>
+auto BuildScheduler::enqueue(TileID id, Priority pri, F&& f) -> std::future<typename std::invoke_result<F>::type>
+{
+  using return_type = typename std::invoke_result<F>::type;
+
+  auto task = std::make_shared< std::packaged_task<return_type()> >(std::forward<F>(f));
+  std::future<return_type> res = task->get_future();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(!m_stop) {
+      lane_t& lane = m_lanes[pri];
+      lane.push_back({id, pri, [task](){ (*task)(); }});
+      m_pending.emplace(id, std::prev(lane.end()));
+    }
+  }
+  m_cv.notify_one();
+  return res;
+}
+
+// move pending task for id to end of foreground lane; returns false if not pending or already foreground
+inline bool BuildScheduler::promote(TileID id)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_pending.find(id);
+  if(it == m_pending.end()) { return false; }
+  Task& task = *it->second;
+  if(task.pri == FOREGROUND) { return false; }
+  lane_t& fg = m_lanes[FOREGROUND];
+  fg.splice(fg.end(), m_lanes[task.pri], it->second);  // list iterators remain valid after splice
+  task.pri = FOREGROUND;
+  ++promotions;
+  return true;
+}
+
+inline void BuildScheduler::requestStop(bool clear)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+    if(clear) {
+      for(lane_t& l : m_lanes) { l.clear(); }
+      m_pending.clear();
+    }
+  }
+  m_cv.notify_all();
+}
+
+inline BuildScheduler::~BuildScheduler()
+{
+  requestStop(false);
+  for(std::thread& worker : m_workers)
+    worker.join();
+}
@@ -1,46 +1,222 @@
+// tile build benchmark: builds a fixed set of tiles (on one thread) after warmup passes, then writes build
+//  time percentiles, throughput, and mean stage times per zoom, plus output size and peak RSS, as JSON, so
+//  results can be compared between commits (make SERVER=0 bench)
+
+#include <sys/resource.h>
 #include "tilebuilder.h"
+#include "lowzoom.h"
+#include "coverage.h"
+#include "ulib.h"
+
+extern std::string buildTile(const Features& world, const Features& ocean, TileID id,
+    TileGeomStore* geomOut = nullptr, const std::vector<const TileGeomStore*>& geomIn = {});
+
+extern void compileTagMatchers();
+extern int buildSearchIndex(const Features& worldGOL, TileID toptile, const std::string& searchDBPath,
+    int numShards = 1);
 
-extern std::string buildTile(const Features& world, const Features& ocean, TileID id);
+static bool parseTileId(const char* s, TileID& id)
+{
+  int z = -1, x = -1, y = -1;
+  if(sscanf(s, "%d/%d/%d", &z, &x, &y) != 3) { return false; }
+  id = TileID(x, y, z);
+  return id.isValid();
+}
 
-extern int buildSearchIndex(const Features& worldGOL, TileID toptile, const std::string& searchDBPath);
+// comma separated list of z/x/y
+static bool parseTileList(const char* s, std::vector<TileID>& tiles)
+{
+  for(const char* p = s; p; p = strchr(p, ',')) {
+    if(*p == ',') { ++p; }
+    TileID id(-1, -1, -1);
+    if(!parseTileId(p, id)) { return false; }
+    tiles.push_back(id);
+  }
+  return true;
+}
+
+// z/x0/y0/x1/y1: all tiles at zoom z in range (inclusive)
+static bool parseTileRange(const char* s, std::vector<TileID>& tiles)
+{
+  int z = -1, x0 = -1, y0 = -1, x1 = -1, y1 = -1;
+  if(sscanf(s, "%d/%d/%d/%d/%d", &z, &x0, &y0, &x1, &y1) != 5) { return false; }
+  if(!TileID(x0, y0, z).isValid() || !TileID(x1, y1, z).isValid()) { return false; }
+  for(int x = std::min(x0, x1); x <= std::max(x0, x1); ++x) {
+    for(int y = std::min(y0, y1); y <= std::max(y0, y1); ++y) { tiles.emplace_back(x, y, z); }
+  }
+  return true;
+}
+
+// nearest rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double p)
+{
+  if(sorted.empty()) { return 0; }
+  size_t rank = size_t(std::ceil(p/100*sorted.size()));
+  return sorted[std::max(rank, size_t(1)) - 1];
+}
 
 int main(int argc, char* argv[])
 {
-  if(argc < 3) {
-    LOG("No gol file specified!");
+  std::vector<TileID> tiles;
+  int warmup = 1;
+  int reps = 5;
+  int ringCacheMB = 256;
+  int labelCacheMB = 32;
+  bool useLowZoomStore = true;
+  std::string coveragePath;
+  const char* jsonPath = nullptr;
+  std::string label;
+  TileID ftsTile(-1, -1, -1);
+
+  int argi = 1;
+  for(; argi < argc-1; argi += 2) {
+    if(strcmp(argv[argi], "--tiles") == 0) {
+      if(!parseTileList(argv[argi+1], tiles)) {
+        LOG("Invalid tile list %s (expected z/x/y,z/x/y,...)", argv[argi+1]);
+        return -1;
+      }
+    }
+    else if(strcmp(argv[argi], "--range") == 0) {
+      if(!parseTileRange(argv[argi+1], tiles)) {
+        LOG("Invalid tile range %s (expected z/x0/y0/x1/y1)", argv[argi+1]);
+        return -1;
+      }
+    }
+    else if(strcmp(argv[argi], "--warmup") == 0)
+      warmup = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--reps") == 0)
+      reps = std::max(1, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--ring-cache-mb") == 0)
+      ringCacheMB = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--label-cache-mb") == 0)
+      labelCacheMB = std::max(0, atoi(argv[argi+1]));
+    else if(strcmp(argv[argi], "--lowzoom-store") == 0)
+      useLowZoomStore = atoi(argv[argi+1]) != 0;
+    else if(strcmp(argv[argi], "--coverage") == 0)
+      coveragePath = argv[argi+1];
+    else if(strcmp(argv[argi], "--tile-budget-kb") == 0)
+      TileBuilder::maxTileBytes = size_t(std::max(0, atoi(argv[argi+1]))) << 10;
+    else if(strcmp(argv[argi], "--json") == 0)
+      jsonPath = argv[argi+1];
+    else if(strcmp(argv[argi], "--label") == 0)
+      label = argv[argi+1];
+    else if(strcmp(argv[argi], "--buildfts") == 0) {
+      if(!parseTileId(argv[argi+1], ftsTile)) {
+        LOG("Tile id %s is invalid (expected z/x/y)", argv[argi+1]);
+        return -1;
+      }
+    }
+    else
+      break;
+  }
+
+  if(argi + 2 != argc) {
+    LOG(R"(Usage: tiletest [options] <OSM gol file> <Ocean gol file>
+Optional arguments:
+  --tiles <z/x/y,...>: tiles to build; can be repeated; default is SF tiles 14/2616/6331 - 14/2621/6336 and
+    parents of 14/2617/6332 to z8
+  --range <z/x0/y0/x1/y1>: add all tiles at zoom z from x0,y0 to x1,y1
+  --warmup <n>: passes over all tiles before timing; default is 1
+  --reps <n>: timed passes over all tiles; default is 5
+  --ring-cache-mb <n>, --label-cache-mb <n>, --lowzoom-store <0|1>, --coverage <file|1>: as for server
+  --tile-budget-kb <n>: as for server
+  --json <file>: write results to file instead of stdout
+  --label <s>: label (e.g. commit hash) included in results
+  --buildfts <z/x/y>: build search index (fts.sqlite) for tile and exit
+)");
     return -1;
   }
 
-  Features world(argv[1]);
-  Features ocean(argv[2]);
-  LOG("Loaded %s and %s", argv[1], argv[2]);
+  auto gol = std::make_shared<GolVersion>(argv[argi], argv[argi+1], 0);
+  LOG("Loaded %s and %s", argv[argi], argv[argi+1]);
+  GolVersion::setActive(gol);
+  const Features& world = gol->world;
+  const Features& ocean = gol->ocean;
 
-  TileBuilder::worldFeats = &world;
+  if(ringCacheMB > 0) { gol->ringCache = std::make_unique<RingCache>(size_t(ringCacheMB) << 20); }
+  if(labelCacheMB > 0) { gol->labelCache = std::make_unique<LabelCache>(size_t(labelCacheMB) << 20); }
+  compileTagMatchers();
 
-  buildSearchIndex(world, TileID(2, 6, 4), "fts.sqlite");
-  return 0;
+  if(ftsTile.isValid()) {
+    return buildSearchIndex(world, ftsTile, "fts.sqlite");
+  }
+
+  if(useLowZoomStore) { gol->lowZoomStore = std::make_unique<LowZoomStore>(world); }
+  if(!coveragePath.empty()) {
+    bool persist = coveragePath != "1";
+    gol->coverage = std::make_unique<OceanCoverage>();
+    if(!persist || !gol->coverage->load(coveragePath.c_str())) {
+      gol->coverage->build(ocean);
+      if(persist && !gol->coverage->save(coveragePath.c_str()))
+        LOG("Error saving ocean coverage to %s", coveragePath.c_str());
+    }
+  }
+
+  if(tiles.empty()) {
+    parseTileRange("14/2616/6331/2621/6336", tiles);
+    for(TileID id = TileID(2617, 6332, 14).getParent(); id.z >= 8; id = id.getParent()) { tiles.push_back(id); }  // Alamo square!
+  }
 
-  // for(int x = 2616; x <= 2621; ++x) {
-  //   for(int y = 6331; y <= 6336; ++y) {
-  //     TileID id(x, y, 14);
-  //     std::string mvt = buildTile(world, id);
-  //   }
-  // }
-
-  // {
-  //   TileID id(662, 1587, 12);
-  //   std::string mvt = buildTile(world, ocean, id);
-  //   return 0;
-  // }
-
-  {
-    TileID id(2617, 6332, 14);  // Alamo square!
-    //TileID id(686, 1607, 12);
-    while(id.z > 7) {
+  // warmup fills ring cache, low zoom store, and OS page cache, so timed passes measure steady state
+  for(int pass = 0; pass < warmup; ++pass) {
+    for(TileID id : tiles) { buildTile(world, ocean, id); }
+  }
+
+  struct ZoomResult {
+    std::vector<double> ms;
+    uint64_t stageNs[NUM_STAGES] = {};
+    size_t bytes = 0;
+    int ntiles = 0;  // distinct tiles
+  } zooms[BuildStats::NUM_ZOOMS];
+
+  for(TileID id : tiles) { ++zooms[id.z].ntiles; }
+  auto t0 = std::chrono::steady_clock::now();
+  size_t totalBytes = 0;
+  for(int pass = 0; pass < reps; ++pass) {
+    for(TileID id : tiles) {
+      ZoomResult& zr = zooms[id.z];
       std::string mvt = buildTile(world, ocean, id);
-      id = id.getParent();
+      const uint64_t* ns = BuildStats::lastStageNs();
+      zr.ms.push_back(ns[STAGE_TOTAL]*1E-6);
+      for(int ii = 0; ii < NUM_STAGES; ++ii) { zr.stageNs[ii] += ns[ii]; }
+      if(pass == 0) { zr.bytes += mvt.size();  totalBytes += mvt.size(); }
     }
   }
+  double totalSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
 
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  std::string json = fstring(R"({"label": "%s", "gol": "%s", "warmup": %d, "reps": %d, "tiles": %d, "builds": %d,)"
+      R"( "seconds": %.3f, "tiles_per_sec": %.2f, "bytes": %lu, "peak_rss_kb": %ld, "zooms": [)",
+      label.c_str(), argv[argi], warmup, reps, int(tiles.size()), int(tiles.size())*reps, totalSecs,
+      tiles.size()*reps/totalSecs, (unsigned long)totalBytes, long(usage.ru_maxrss));
+  const char* sep = "";
+  for(int z = 0; z < BuildStats::NUM_ZOOMS; ++z) {
+    ZoomResult& zr = zooms[z];
+    if(zr.ms.empty()) { continue; }
+    std::sort(zr.ms.begin(), zr.ms.end());
+    double sumMs = zr.stageNs[STAGE_TOTAL]*1E-6;
+    json += fstring(R"(%s{"zoom": %d, "tiles": %d, "p50_ms": %.3f, "p95_ms": %.3f, "p99_ms": %.3f, "mean_ms": %.3f,)"
+        R"( "tiles_per_sec": %.2f, "bytes": %lu, "stage_mean_ms": {)", sep, z, zr.ntiles, percentile(zr.ms, 50),
+        percentile(zr.ms, 95), percentile(zr.ms, 99), sumMs/zr.ms.size(), zr.ms.size()*1000/sumMs,
+        (unsigned long)zr.bytes);
+    for(int ii = 0; ii < NUM_STAGES; ++ii) {
+      json += fstring(R"(%s"%s": %.3f)", ii > 0 ? ", " : "", BuildStats::stageNames[ii], zr.stageNs[ii]*1E-6/zr.ms.size());
+    }
+    json += "}}";
+    sep = ", ";
+  }
+  json += "]}\n";
+
+  FILE* f = jsonPath ? fopen(jsonPath, "w") : stdout;
+  if(!f) {
+    LOG("Error opening %s", jsonPath);
+    return -1;
+  }
+  fputs(json.c_str(), f);
+  if(jsonPath) { fclose(f); }
+  LOG("Built %d tiles x %d in %.2f s (%.1f tiles/s), peak RSS %ld MB", int(tiles.size()), reps, totalSecs,
+      tiles.size()*reps/totalSecs, long(usage.ru_maxrss)/1024);
   return 0;
 }
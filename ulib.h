@@ -4,8 +4,13 @@
 
 // thread pool based on github.com/progschj/ThreadPool
 
+#include <cstddef>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <memory>
 #include <thread>
 #include <future>
@@ -105,6 +110,217 @@ inline ThreadPool::~ThreadPool()
     worker.join();
 }
 
+// work stealing thread pool w/ same API as ThreadPool
+// - each worker has its own deque: worker pushes and pops its own tasks at the back (so recursive fan out
+//  proceeds depth first) and steals from the front of other workers' deques when its own is empty
+// - tasks are move-only w/ inline storage, so post() doesn't allocate unless callable is large; enqueue()
+//  additionally allocates the std::future shared state
+// - unlike ThreadPool, tasks are not run in FIFO order, so use ThreadPool(1) when order matters
+
+// move-only type erased callable w/ small buffer
+class PoolTask
+{
+public:
+  static constexpr size_t BUF_SIZE = 56;
+
+  PoolTask() {}
+  template<class F, class T = std::decay_t<F>, class = std::enable_if_t<!std::is_same_v<T, PoolTask>>>
+  PoolTask(F&& f)
+  {
+    if constexpr(sizeof(T) <= BUF_SIZE && alignof(T) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible_v<T>) {
+      new (buf) T(std::forward<F>(f));
+      ops = &inlineOps<T>;
+    }
+    else {
+      *reinterpret_cast<T**>(buf) = new T(std::forward<F>(f));
+      ops = &heapOps<T>;
+    }
+  }
+  PoolTask(PoolTask&& other) noexcept : ops(other.ops) { if(ops) { ops->move(buf, other.buf);  other.ops = nullptr; } }
+  PoolTask& operator=(PoolTask&& other) noexcept
+  {
+    if(this != &other) { reset();  ops = other.ops;  if(ops) { ops->move(buf, other.buf);  other.ops = nullptr; } }
+    return *this;
+  }
+  ~PoolTask() { reset(); }
+  void operator()() { ops->invoke(buf); }
+  explicit operator bool() const { return ops != nullptr; }
+
+private:
+  struct Ops {
+    void (*invoke)(void*);
+    void (*move)(void* dst, void* src);  // move src to dst and destroy src
+    void (*destroy)(void*);
+  };
+  template<class T> static constexpr Ops inlineOps = {
+    [](void* p){ (*static_cast<T*>(p))(); },
+    [](void* dst, void* src){ new (dst) T(std::move(*static_cast<T*>(src)));  static_cast<T*>(src)->~T(); },
+    [](void* p){ static_cast<T*>(p)->~T(); }
+  };
+  template<class T> static constexpr Ops heapOps = {
+    [](void* p){ (**static_cast<T**>(p))(); },
+    [](void* dst, void* src){ *static_cast<T**>(dst) = *static_cast<T**>(src); },
+    [](void* p){ delete *static_cast<T**>(p); }
+  };
+
+  void reset() { if(ops) { ops->destroy(buf);  ops = nullptr; } }
+
+  alignas(std::max_align_t) unsigned char buf[BUF_SIZE];
+  const Ops* ops = nullptr;
+};
+
+class WorkStealingPool
+{
+public:
+  WorkStealingPool(size_t nthreads);
+  template<class F, class... Args>
+  auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+  template<class F>
+  void post(F&& f) { push(PoolTask(std::forward<F>(f))); }
+  void requestStop(bool clear = false);
+  void waitForIdle();
+  ~WorkStealingPool();
+
+private:
+  struct alignas(64) Worker {
+    std::mutex mutex;
+    std::deque<PoolTask> tasks;
+  };
+
+  void push(PoolTask&& task);
+  bool pop(size_t idx, PoolTask& task);
+  void run(size_t idx);
+
+  std::vector< std::unique_ptr<Worker> > queues;
+  std::vector< std::thread > workers;
+  std::atomic_size_t n_queued = 0;  // tasks in all queues
+  std::atomic_size_t n_running = 0;  // tasks being run
+  std::atomic_size_t n_sleeping = 0;
+  std::atomic_size_t next_queue = 0;  // for tasks pushed from outside pool
+  std::atomic_bool stop = false;
+  std::mutex sleep_mutex;
+  std::condition_variable sleep_cv;
+  std::condition_variable idle_cv;
+
+  static inline thread_local WorkStealingPool* tl_pool = nullptr;
+  static inline thread_local size_t tl_index = 0;
+};
+
+inline WorkStealingPool::WorkStealingPool(size_t nthreads)
+{
+  if(nthreads == 0)
+    nthreads = std::thread::hardware_concurrency();
+  for(size_t ii = 0; ii < nthreads; ++ii)
+    queues.emplace_back(new Worker);
+  for(size_t ii = 0; ii < nthreads; ++ii)
+    workers.emplace_back([this, ii](){ run(ii); });
+}
+
+inline void WorkStealingPool::run(size_t idx)
+{
+  tl_pool = this;
+  tl_index = idx;
+  PoolTask task;
+  for(;;) {
+    if(pop(idx, task)) {
+      task();
+      task = PoolTask();
+      if(--n_running == 0 && n_queued == 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        idle_cv.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    ++n_sleeping;
+    sleep_cv.wait(lock, [this](){ return stop || n_queued > 0; });
+    --n_sleeping;
+    if(stop && n_queued == 0)
+      return;
+  }
+}
+
+// take task from back of own queue, otherwise steal from front of another queue
+inline bool WorkStealingPool::pop(size_t idx, PoolTask& task)
+{
+  size_t n = queues.size();
+  for(size_t ii = 0; ii < n && n_queued > 0; ++ii) {
+    Worker& q = *queues[(idx + ii) % n];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if(q.tasks.empty()) { continue; }
+    if(ii == 0) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    }
+    else {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    ++n_running;  // increment before decrementing n_queued so waitForIdle() doesn't see zero for both
+    --n_queued;
+    return true;
+  }
+  return false;
+}
+
+inline void WorkStealingPool::push(PoolTask&& task)
+{
+  if(stop) { return; }
+  size_t idx = tl_pool == this ? tl_index : next_queue++ % queues.size();
+  {
+    Worker& q = *queues[idx];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    q.tasks.push_back(std::move(task));
+    ++n_queued;
+  }
+  // sleeping worker increments n_sleeping before checking n_queued, so can't miss this
+  if(n_sleeping > 0) {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    sleep_cv.notify_one();
+  }
+}
+
+// add new work item to the pool - returns a std::future, which has a wait() method
+template<class F, class... Args>
+auto WorkStealingPool::enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>
+{
+  using return_type = typename std::result_of<F(Args...)>::type;
+
+  std::packaged_task<return_type()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+  std::future<return_type> res = task.get_future();
+  push(PoolTask(std::move(task)));
+  return res;
+}
+
+inline void WorkStealingPool::waitForIdle()
+{
+  std::unique_lock<std::mutex> lock(sleep_mutex);
+  idle_cv.wait(lock, [&](){ return n_queued == 0 && n_running == 0; });
+}
+
+inline void WorkStealingPool::requestStop(bool clear)
+{
+  stop = true;
+  if(clear) {
+    for(auto& q : queues) {
+      std::lock_guard<std::mutex> lock(q->mutex);
+      n_queued -= q->tasks.size();
+      q->tasks.clear();
+    }
+  }
+  std::lock_guard<std::mutex> lock(sleep_mutex);
+  sleep_cv.notify_all();
+  idle_cv.notify_all();
+}
+
+inline WorkStealingPool::~WorkStealingPool()
+{
+  requestStop(false);
+  for(std::thread &worker: workers)
+    worker.join();
+}
+
 // stringutils.h
 
 template<template<class, class...> class Container, class... Container_Params>
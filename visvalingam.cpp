@@ -30,111 +30,62 @@
 #include <cmath>
 #include "clipper.h"
 
-// Stuff to create the priority queue, or min heap.
-// Rewriting it here, vs using the std lib, resulted in a 50% performance bump!
+// Points are kept in a doubly linked list (as index arrays) and an implicit binary min heap ordered by the
+//  area of the triangle formed with neighboring points; all arrays are reused for every call on a thread,
+//  so no allocation is needed once they have grown to the largest ring seen
 
-struct visItem {
-  double area = 0;     // triangle area
-  int ptidx = 0;  // index of point in original path
-
-  // to keep a virtual linked list to help rebuild the triangle areas as we remove points.
-  visItem *next = NULL;
-  visItem *prev = NULL;
-
-  int index = 0;  // internal index in heap, for removal and update
+struct HeapEntry {
+  double area;  // triangle area
+  int idx;  // index of point in original path
 };
 
-struct minHeap {
-  std::vector<visItem *> h;
+struct AreaHeap {
+  std::vector<HeapEntry> h;
+  std::vector<int> pos;  // position of each point in h
 
-  void Push(visItem *item) {
-    item->index = h.size();
-    h.push_back(item);
-    up(item->index);
-  }
-
-  visItem *Pop() {
-    visItem *removed = h[0];
-    visItem *lastItem = h[h.size() - 1];
-    h.pop_back();
+  void set(size_t i, HeapEntry e) { h[i] = e;  pos[e.idx] = i; }
 
-    if (h.size() > 0) {
-      lastItem->index = 0;
-      h[0] = lastItem;
-      down(0);
+  void up(size_t i) {
+    HeapEntry e = h[i];
+    while (i > 0) {
+      size_t parent = (i - 1) >> 1;
+      if (h[parent].area <= e.area) break;
+      set(i, h[parent]);
+      i = parent;
     }
-
-    return removed;
+    set(i, e);
   }
 
-  void Update(visItem *item, double area) {
-    if (item->area > area) {
-      // area got smaller
-      item->area = area;
-      up(item->index);
-    } else {
-      // area got larger
-      item->area = area;
-      down(item->index);
+  void down(size_t i) {
+    HeapEntry e = h[i];
+    const size_t n = h.size();
+    while (1) {
+      size_t child = 2*i + 1;
+      if (child >= n) break;
+      if (child + 1 < n && h[child + 1].area < h[child].area) ++child;
+      if (h[child].area >= e.area) break;
+      set(i, h[child]);
+      i = child;
     }
+    set(i, e);
   }
 
-  void up(int i) {
-    visItem *object = h[i];
-    while (i > 0) {
-      int up = ((i + 1) >> 1) - 1;
-      visItem *parent = h[up];
-
-      if (parent->area <= object->area) {
-        // parent is smaller so we're done fixing up the heap.
-        break;
-      }
-
-      // swap nodes
-      parent->index = i;
-      h[i] = parent;
-
-      object->index = up;
-      h[up] = object;
-
-      i = up;
+  HeapEntry pop() {
+    HeapEntry top = h[0];
+    HeapEntry last = h.back();
+    h.pop_back();
+    if (!h.empty()) {
+      h[0] = last;
+      down(0);
     }
+    return top;
   }
 
-  void down(int i) {
-    visItem *object = h[i];
-    while (1) {
-      size_t right = (i + 1) << 1;
-      size_t left = right - 1;
-
-      int down = i;
-      visItem *child = h[down];
-
-      // swap with smallest child
-      if (left < h.size() && h[left]->area < child->area) {
-        down = left;
-        child = h[down];
-      }
-
-      if (right < h.size() && h[right]->area < child->area) {
-        down = right;
-        child = h[down];
-      }
-
-      // non smaller, so quit
-      if (down == i) {
-        break;
-      }
-
-      // swap the nodes
-      child->index = i;
-      h[child->index] = child;
-
-      object->index = down;
-      h[down] = object;
-
-      i = down;
-    }
+  void update(int idx, double area) {
+    size_t i = pos[idx];
+    double prev = h[i].area;
+    h[i].area = area;
+    if (area < prev) up(i); else down(i);
   }
 };
 
@@ -147,84 +98,66 @@ static double doubleTriangleArea(const std::vector<vt_point>& pts, int i1, int i
   return std::abs((b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x));
 }
 
-std::vector<int> visvalingam(const std::vector<vt_point>& pts, real thresh)
+// writes 1 to keep for each point kept; keep is left empty (keep all) if no simplification needed
+void visvalingam(const std::vector<vt_point>& pts, real thresh, std::vector<int>& keep)
 {
-  if(thresh <= 0 || pts.size() < 3) { return {}; }
+  keep.clear();
+  if(thresh <= 0 || pts.size() < 3) { return; }
   // edge cases checked, get on with it
-  //int removed = 0;
   thresh *= 2;
-
-  // build the initial minheap linked list.
-  minHeap heap;
-  heap.h.reserve(pts.size());
-
-  visItem linkedListStart;
-  linkedListStart.area = INFINITY;
-  linkedListStart.ptidx = 0;
-  heap.Push(&linkedListStart);
-
-  // internal path items
-  std::vector<visItem> items;
-  items.resize(pts.size());
-
-  {
-    visItem *prev = &linkedListStart;
-    for (size_t i = 1; i < pts.size() - 1; i++) {
-      visItem *item = &items[i];
-
-      item->area = doubleTriangleArea(pts, i - 1, i, i + 1);
-      item->ptidx = i;
-      item->prev = prev;
-
-      heap.Push(item);
-      prev->next = item;
-      prev = item;
-    }
-
-    // final item
-    visItem *endItem = &items.back();  //items[pts.size() - 1];
-    endItem->area = INFINITY;
-    endItem->ptidx = pts.size() - 1;  //(end - start) - 1;
-    endItem->prev = prev;
-
-    prev->next = endItem;
-    heap.Push(endItem);
+  const int n = pts.size();
+
+  keep.assign(n, 0);
+  keep.front() = 1;  keep.back() = 1;
+  // triangle w/ vertices inside bbox has (double) area at most w*h, so all interior points would be removed
+  vt_point pmin = pts[0], pmax = pts[0];
+  for (const vt_point& p : pts) { pmin = min(pmin, p);  pmax = max(pmax, p); }
+  if ((pmax.x - pmin.x)*(pmax.y - pmin.y) <= thresh) { return; }
+
+  static thread_local AreaHeap heap;
+  static thread_local std::vector<int> prev, next;
+
+  // build the initial linked list and heap of interior points (end points are never removed)
+  prev.resize(n);
+  next.resize(n);
+  heap.pos.resize(n);
+  heap.h.resize(n - 2);
+  next[0] = 1;
+  prev[n - 1] = n - 2;
+  for (int i = 1; i < n - 1; i++) {
+    prev[i] = i - 1;
+    next[i] = i + 1;
+    heap.set(i - 1, {doubleTriangleArea(pts, i - 1, i, i + 1), i});
+  }
+  for (int i = (n - 2)/2; i >= 0; --i) {
+    heap.down(i);
   }
 
   // run through the reduction process
-  while (heap.h.size() > 0) {
-    visItem *current = heap.Pop();
-    if (current->area > thresh) {  // || (end - start) - removed <= retain) {
+  while (!heap.h.empty()) {
+    HeapEntry current = heap.pop();
+    if (current.area > thresh) {
+      heap.h.clear();
       break;
     }
 
-    visItem *next = current->next;
-    visItem *prev = current->prev;
-
     // remove current element from linked list
-    prev->next = current->next;
-    next->prev = current->prev;
-    //removed++;
+    int p = prev[current.idx];
+    int q = next[current.idx];
+    next[p] = q;
+    prev[q] = p;
 
     // figure out the new areas
-    if (prev->prev != NULL) {
-      double area = doubleTriangleArea(pts, prev->prev->ptidx, prev->ptidx, next->ptidx);
-      area = std::max(area, current->area);
-      heap.Update(prev, area);
+    if (p > 0) {
+      heap.update(p, std::max(doubleTriangleArea(pts, prev[p], p, q), current.area));
     }
 
-    if (next->next != NULL) {
-      double area = doubleTriangleArea(pts, prev->ptidx, next->ptidx, next->next->ptidx);
-      area = std::max(area, current->area);
-      heap.Update(next, area);
+    if (q < n - 1) {
+      heap.update(q, std::max(doubleTriangleArea(pts, p, q, next[q]), current.area));
     }
   }
 
-  std::vector<int> keep(pts.size(), 0);
-  visItem *item = &linkedListStart;
-  while (item != NULL) {
-    keep[item->ptidx] = 1;
-    item = item->next;
+  for (int i = next[0]; i < n - 1; i = next[i]) {
+    keep[i] = 1;
   }
-  return keep;
 }